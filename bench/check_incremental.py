@@ -0,0 +1,64 @@
+#!/usr/bin/env python3
+"""Check the incremental re-analysis of the dataflow passes.
+
+Runs cse231-check-incremental (incremental/Check*.cpp) over the synthetic
+modules of gen_ir.py: every function is edited at random several times,
+solved again with rerunWorklistAlgorithm, and compared with a full run.
+
+    check_incremental.py --reaching check-reaching.so --liveness check-liveness.so \\
+        --maypointto check-maypointto.so [--sizes 1000] [--edits 20]
+
+The exit status is 1 if any result differs from a full run.
+"""
+
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+
+import gen_ir
+from run_bench import PASSES, module_path, opt_flags
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Check the incremental re-analysis.')
+    for name in PASSES:
+        parser.add_argument('--' + name, help='plugin built from incremental/Check*.cpp for cse231-' + name)
+    parser.add_argument('--shapes', default=','.join(sorted(gen_ir.SHAPES)))
+    parser.add_argument('--sizes', default='1000')
+    parser.add_argument('--func-size', type=int, default=200)
+    parser.add_argument('--edits', type=int, default=20, help='edits of each function')
+    parser.add_argument('--opt', default='opt')
+    parser.add_argument('--llvm-as', default='llvm-as')
+    parser.add_argument('--workdir', help='where the generated modules are kept')
+    args = parser.parse_args()
+
+    plugins = {name: getattr(args, name) for name in PASSES if getattr(args, name)}
+    if not plugins:
+        sys.exit('error: no plugin given')
+    flags = opt_flags(args.opt)
+    workdir = args.workdir or tempfile.mkdtemp(prefix='cse231-incremental-')
+    os.makedirs(workdir, exist_ok=True)
+
+    failures = 0
+    for shape in args.shapes.split(','):
+        for size in [int(s) for s in args.sizes.split(',')]:
+            module = module_path(workdir, shape, size, args.func_size, args.llvm_as)
+            for name, plugin in plugins.items():
+                cmd = [args.opt] + flags + ['-load', plugin, '-cse231-check-incremental',
+                                            '-check-incremental-edits=%d' % args.edits,
+                                            '-disable-output', module]
+                proc = subprocess.run(cmd, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, text=True)
+                for line in proc.stderr.splitlines():
+                    print('%s-%d: %s' % (shape, size, line), flush=True)
+                if proc.returncode != 0 or 'mismatch: ' in proc.stderr:
+                    failures += 1
+
+    if failures:
+        sys.exit(1)
+    print('incremental re-analysis matches a full run')
+
+
+if __name__ == '__main__':
+    main()
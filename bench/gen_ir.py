@@ -0,0 +1,260 @@
+#!/usr/bin/env python3
+"""Generate synthetic LLVM IR modules for benchmarking the dataflow passes.
+
+Shapes:
+  loopnest   deep loop nests with arithmetic in every body
+  switch     a switch with a huge fan-out merged by one phi per value
+  phichain   a long chain of diamonds whose merges carry many phis
+  ptrweb     alloca/store/load/select/GEP webs over many pointer slots
+
+The size is the number of instructions of the module. It is split into
+functions of about --func-size instructions (fewer for ptrweb), so that
+the per-function information of the passes stays bounded while the module
+grows.
+
+    gen_ir.py loopnest 100000 -o loopnest-100000.ll
+    gen_ir.py ptrweb 1000 --bitcode -o ptrweb-1000.bc
+
+The output only depends on the arguments (the random generator is seeded).
+"""
+
+import argparse
+import random
+import subprocess
+import sys
+
+
+class Function:
+    """Collects the text of a function and counts its instructions."""
+
+    def __init__(self, name, args):
+        self.lines = ['define i32 @%s(%s) {' % (name, args)]
+        self.count = 0
+        self.tmp = 0
+
+    def label(self, name):
+        self.lines.append('%s:' % name)
+
+    def inst(self, text):
+        self.lines.append('  ' + text)
+        self.count += 1
+
+    def fresh(self, prefix='t'):
+        self.tmp += 1
+        return '%%%s%d' % (prefix, self.tmp)
+
+    def text(self):
+        return '\n'.join(self.lines + ['}', ''])
+
+
+def arith(fn, rng, values, n):
+    """Append n arithmetic instructions over values; return the last result."""
+    ops = ['add', 'sub', 'mul', 'xor', 'and', 'or', 'shl']
+    last = values[-1]
+    for _ in range(n):
+        a = rng.choice(values)
+        b = rng.choice(values + ['%d' % rng.randint(1, 31)])
+        last = fn.fresh()
+        fn.inst('%s = %s i32 %s, %s' % (last, rng.choice(ops), a, b))
+        values.append(last)
+    return last
+
+
+def gen_loopnest(name, budget, rng):
+    # Loop k: head phis (i, acc), compare, body, latch, exit to the outer latch
+    depth = 8
+    fill = max(1, (budget - 7 * depth) // depth)
+    fn = Function(name, 'i32 %n')
+    fn.label('entry')
+    fn.inst('br label %h0')
+    for k in range(depth):
+        pre = 'entry' if k == 0 else 'b%d' % (k - 1)
+        init = '0' if k == 0 else '%%acc%d' % (k - 1)
+        fn.label('h%d' % k)
+        fn.inst('%%i%d = phi i32 [ 0, %%%s ], [ %%i%d.next, %%latch%d ]' % (k, pre, k, k))
+        fn.inst('%%acc%d = phi i32 [ %s, %%%s ], [ %%acc%d.next, %%latch%d ]' % (k, init, pre, k, k))
+        fn.inst('%%c%d = icmp slt i32 %%i%d, %%n' % (k, k))
+        fn.inst('br i1 %%c%d, label %%b%d, label %%x%d' % (k, k, k))
+        fn.label('b%d' % k)
+        arith(fn, rng, ['%%i%d' % k, '%%acc%d' % k, '%n'], fill)
+        fn.inst('br label %%%s' % ('h%d' % (k + 1) if k + 1 < depth else 'latch%d' % k))
+    for k in reversed(range(depth)):
+        inner = '%%acc%d' % (k + 1) if k + 1 < depth else '%%i%d' % k
+        fn.label('latch%d' % k)
+        fn.inst('%%i%d.next = add i32 %%i%d, 1' % (k, k))
+        fn.inst('%%acc%d.next = add i32 %%acc%d, %s' % (k, k, inner))
+        fn.inst('br label %%h%d' % k)
+        fn.label('x%d' % k)
+        if k == 0:
+            fn.inst('ret i32 %acc0')
+        else:
+            fn.inst('br label %%latch%d' % (k - 1))
+    return fn
+
+
+def gen_switch(name, budget, rng):
+    # One case block of two instructions per case, merged by a phi per value
+    values = 4
+    cases = max(2, (budget - 4 - values) // (2 + values))
+    fn = Function(name, 'i32 %x, i32 %y')
+    fn.label('entry')
+    fn.inst('%%s = and i32 %%x, %d' % (2 * cases))
+    targets = ' '.join('i32 %d, label %%case%d' % (c, c) for c in range(cases))
+    fn.inst('switch i32 %%s, label %%default [ %s ]' % targets)
+    incoming = [[] for _ in range(values)]
+    for c in range(cases + 1):
+        block = 'case%d' % c if c < cases else 'default'
+        fn.label(block)
+        v = fn.fresh('v')
+        fn.inst('%s = %s i32 %%y, %d' % (v, rng.choice(['add', 'mul', 'xor']), c + 1))
+        for k in range(values):
+            incoming[k].append('[ %s, %%%s ]' % (v if k % 2 == 0 else '%d' % (c * k), block))
+        fn.inst('br label %merge')
+    fn.label('merge')
+    for k in range(values):
+        fn.inst('%%m%d = phi i32 %s' % (k, ', '.join(incoming[k])))
+    fn.inst('%sum = add i32 %m0, %m1')
+    fn.inst('ret i32 %sum')
+    return fn
+
+
+def gen_phichain(name, budget, rng):
+    # An outer loop around a chain of diamonds; every merge carries width phis
+    width = 6
+    steps = max(1, (budget - 12) // (2 * width + 6))
+    fn = Function(name, 'i32 %n, i32 %c')
+    fn.label('entry')
+    fn.inst('br label %head')
+    fn.label('head')
+    fn.inst('%it = phi i32 [ 0, %entry ], [ %it.next, %tail ]')
+    cur = []
+    for k in range(width):
+        p = '%%p%d' % k
+        fn.inst('%s = phi i32 [ %d, %%entry ], [ %%out%d, %%tail ]' % (p, k, k))
+        cur.append(p)
+    fn.inst('br label %d0')
+    for s in range(steps):
+        fn.label('d%d' % s)
+        cond = fn.fresh('c')
+        fn.inst('%s = icmp slt i32 %s, %%c' % (cond, rng.choice(cur)))
+        fn.inst('br i1 %s, label %%dl%d, label %%dr%d' % (cond, s, s))
+        fn.label('dl%d' % s)
+        lv = fn.fresh('l')
+        fn.inst('%s = add i32 %s, %s' % (lv, cur[0], cur[-1]))
+        fn.inst('br label %%dm%d' % s)
+        fn.label('dr%d' % s)
+        rv = fn.fresh('r')
+        fn.inst('%s = mul i32 %s, 3' % (rv, rng.choice(cur)))
+        fn.inst('br label %%dm%d' % s)
+        fn.label('dm%d' % s)
+        nxt = []
+        for k in range(width):
+            p = fn.fresh('q')
+            left = lv if k % 2 == 0 else cur[k]
+            right = rv if k % 3 == 0 else cur[(k + 1) % width]
+            fn.inst('%s = phi i32 [ %s, %%dl%d ], [ %s, %%dr%d ]' % (p, left, s, right, s))
+            nxt.append(p)
+        cur = nxt
+        fn.inst('br label %%%s' % ('d%d' % (s + 1) if s + 1 < steps else 'tail'))
+    fn.label('tail')
+    for k in range(width):
+        fn.inst('%%out%d = add i32 %s, 1' % (k, cur[k]))
+    fn.inst('%it.next = add i32 %it, 1')
+    fn.inst('%again = icmp slt i32 %it.next, %n')
+    fn.inst('br i1 %again, label %head, label %exit')
+    fn.label('exit')
+    fn.inst('ret i32 %out0')
+    return fn
+
+
+# The may-point-to information of an edge grows with the number of pointers of
+# the function, so the total grows quadratically; keep these functions small.
+PTRWEB_FUNC_SIZE = 200
+
+
+def gen_ptrweb(name, budget, rng):
+    # Slots hold pointers to objects or to other slots; blocks shuffle them
+    budget = min(budget, PTRWEB_FUNC_SIZE)
+    objs = 16
+    slots = 16
+    fn = Function(name, 'i32 %c')
+    fn.label('entry')
+    for k in range(objs):
+        fn.inst('%%o%d = alloca i32' % k)
+    for k in range(slots):
+        fn.inst('%%s%d = alloca i32*' % k)
+    fn.inst('%pp = alloca i32**')
+    for k in range(slots):
+        fn.inst('store i32* %%o%d, i32** %%s%d' % (k % objs, k))
+    fn.inst('br label %w0')
+    blocks = max(1, (budget - fn.count - 4) // 14)
+    for b in range(blocks):
+        fn.label('w%d' % b)
+        for _ in range(3):
+            src = '%%s%d' % rng.randrange(slots)
+            dst = '%%s%d' % rng.randrange(slots)
+            v = fn.fresh('ld')
+            fn.inst('%s = load i32*, i32** %s' % (v, src))
+            g = fn.fresh('gep')
+            fn.inst('%s = getelementptr i32, i32* %s, i64 1' % (g, v))
+            fn.inst('store i32* %s, i32** %s' % (rng.choice([v, g]), dst))
+        fn.inst('store i32** %%s%d, i32*** %%pp' % rng.randrange(slots))
+        q = fn.fresh('pp')
+        fn.inst('%s = load i32**, i32*** %%pp' % q)
+        fn.inst('store i32* %%o%d, i32** %s' % (rng.randrange(objs), q))
+        cond = fn.fresh('c')
+        fn.inst('%s = icmp slt i32 %%c, %d' % (cond, b))
+        sel = fn.fresh('sel')
+        fn.inst('%s = select i1 %s, i32* %%o%d, i32* %%o%d' % (sel, cond, rng.randrange(objs), rng.randrange(objs)))
+        fn.inst('store i32* %s, i32** %%s%d' % (sel, rng.randrange(slots)))
+        nxt = 'w%d' % (b + 1) if b + 1 < blocks else 'exit'
+        back = 'w%d' % rng.randrange(b + 1)
+        fn.inst('br i1 %s, label %%%s, label %%%s' % (cond, nxt, back if b % 4 == 3 else nxt))
+    fn.label('exit')
+    fn.inst('ret i32 0')
+    return fn
+
+
+SHAPES = {
+    'loopnest': gen_loopnest,
+    'switch': gen_switch,
+    'phichain': gen_phichain,
+    'ptrweb': gen_ptrweb,
+}
+
+
+def generate(shape, size, func_size, seed=231):
+    rng = random.Random('%s-%d-%d' % (shape, size, seed))
+    funcs = []
+    total = 0
+    while total < size:
+        fn = SHAPES[shape]('%s%d' % (shape, len(funcs)), min(func_size, size - total), rng)
+        funcs.append(fn.text())
+        total += fn.count
+    return '; %s, %d instructions in %d functions\n\n' % (shape, total, len(funcs)) + '\n'.join(funcs)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Generate a synthetic IR module.')
+    parser.add_argument('shape', choices=sorted(SHAPES))
+    parser.add_argument('size', type=int, help='number of instructions of the module')
+    parser.add_argument('--func-size', type=int, default=2000,
+                        help='approximate number of instructions per function')
+    parser.add_argument('--bitcode', action='store_true', help='assemble the output with llvm-as')
+    parser.add_argument('--llvm-as', default='llvm-as')
+    parser.add_argument('-o', '--output', default='-')
+    args = parser.parse_args()
+
+    text = generate(args.shape, args.size, args.func_size)
+    if args.bitcode:
+        out = '-' if args.output == '-' else args.output
+        subprocess.run([args.llvm_as, '-', '-o', out], input=text.encode(), check=True)
+    elif args.output == '-':
+        sys.stdout.write(text)
+    else:
+        with open(args.output, 'w') as f:
+            f.write(text)
+
+
+if __name__ == '__main__':
+    main()
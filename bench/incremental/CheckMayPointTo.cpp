@@ -0,0 +1,22 @@
+/*
+ * cse231-check-incremental for cse231-maypointto (see IncrementalCheck.h). Build it
+ * like the pass, with part3 on the include path.
+ */
+#include "MayPointToAnalysis.cpp"
+#include "IncrementalCheck.h"
+
+namespace {
+struct CheckIncremental : public ModulePass {
+  static char ID;
+  CheckIncremental() : ModulePass(ID) {}
+
+  bool runOnModule(Module &M) override {
+    IncrementalCheck<MayPointToAnalysis, MayPointToInfo>::run(M, "maypointto");
+    return true;
+  }
+};
+}
+
+char CheckIncremental::ID = 0;
+static RegisterPass<CheckIncremental> Check("cse231-check-incremental",
+    "Check the incremental re-analysis of cse231-maypointto", false, false);
@@ -0,0 +1,149 @@
+#ifndef CSE231_INCREMENTAL_CHECK_H
+#define CSE231_INCREMENTAL_CHECK_H
+
+#include "llvm/Pass.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <random>
+#include <string>
+#include <vector>
+
+static llvm::cl::opt<unsigned> CheckEdits("check-incremental-edits", llvm::cl::init(20),
+    llvm::cl::desc("Number of random edits applied to each function"));
+
+static llvm::cl::opt<bool> CheckIntern("check-incremental-intern",
+    llvm::cl::desc("Intern the informations of both solvers"));
+
+/*
+ * Checks DataFlowAnalysis::rerunWorklistAlgorithm against a full run. Every
+ * function is solved once; then, -check-incremental-edits times, it is edited at
+ * random, solved again incrementally from the changed blocks, and the result is
+ * compared with that of a fresh solver. The edits:
+ *   0  an operand of a binary operator becomes a constant
+ *   1  a new instruction at the top or the bottom of a block
+ *   2  an instruction without uses is erased
+ *   3  a value is replaced by undef and erased
+ *   4  a store stores a new alloca instead of its pointer
+ *   5  a block is split, which changes the CFG (rerun falls back to a full run)
+ * The module is changed, so run it with -disable-output.
+ */
+template <class Analysis, class InfoT>
+class IncrementalCheck {
+  public:
+    static const char * editName(int kind) {
+      static const char * const names[] = {"operand", "insert", "erase", "replace", "store", "split"};
+      return names[kind];
+    }
+
+    /* Apply a random edit of F; the changed blocks, or none if it did nothing */
+    static std::vector<llvm::BasicBlock *> edit(llvm::Function & F, std::mt19937 & rng, int & kind) {
+      std::vector<llvm::BasicBlock *> blocks;
+      for (llvm::BasicBlock & BB : F)
+        blocks.push_back(&BB);
+      llvm::BasicBlock * BB = blocks[rng() % blocks.size()];
+      std::vector<llvm::Instruction *> insts;
+      for (llvm::Instruction & I : *BB)
+        if (!llvm::isa<llvm::PHINode>(I) && !I.isTerminator())
+          insts.push_back(&I);
+
+      kind = rng() % 6;
+      switch (kind) {
+        case 0:
+          for (llvm::Instruction * I : insts)
+            if (I->isBinaryOp()) {
+              I->setOperand(rng() % 2, llvm::ConstantInt::get(I->getType(), 7));
+              return {BB};
+            }
+          return {};
+        case 1: {
+          llvm::IRBuilder<> builder(rng() % 2 ? BB->getTerminator() : &*BB->getFirstInsertionPt());
+          builder.CreateAlloca(builder.getInt32Ty());
+          return {BB};
+        }
+        case 2:
+          for (llvm::Instruction * I : insts)
+            if (I->use_empty() && !llvm::isa<llvm::StoreInst>(I) && !llvm::isa<llvm::CallBase>(I)) {
+              I->eraseFromParent();
+              return {BB};
+            }
+          return {};
+        case 3:
+          for (llvm::Instruction * I : insts) {
+            if (I->getType()->isVoidTy() || llvm::isa<llvm::CallBase>(I))
+              continue;
+            std::vector<llvm::BasicBlock *> changed{BB};
+            for (llvm::User * U : I->users())
+              changed.push_back(llvm::cast<llvm::Instruction>(U)->getParent());
+            I->replaceAllUsesWith(llvm::UndefValue::get(I->getType()));
+            I->eraseFromParent();
+            return changed;
+          }
+          return {};
+        case 4:
+          for (llvm::Instruction * I : insts) {
+            llvm::StoreInst * S = llvm::dyn_cast<llvm::StoreInst>(I);
+            if (!S || !S->getValueOperand()->getType()->isPointerTy())
+              continue;
+            llvm::AllocaInst * A = new llvm::AllocaInst(llvm::Type::getInt8Ty(F.getContext()), 0, "", S);
+            S->setOperand(0, llvm::CastInst::CreatePointerBitCastOrAddrSpaceCast(
+                A, S->getValueOperand()->getType(), "", S));
+            return {BB};
+          }
+          return {};
+        default:
+          if (insts.empty())
+            return {};
+          BB->splitBasicBlock(insts[rng() % insts.size()]);
+          return {BB};
+      }
+    }
+
+    static std::string printed(Analysis & A) {
+      std::string text;
+      llvm::raw_string_ostream OS(text);
+      A.print(OS);
+      return OS.str();
+    }
+
+    /* Check every function of M; prints a summary and returns the number of mismatches */
+    static unsigned run(llvm::Module & M, llvm::StringRef name) {
+      std::mt19937 rng(231);
+      unsigned edits = 0, fallbacks = 0, mismatches = 0;
+      for (llvm::Function & F : M) {
+        if (F.isDeclaration())
+          continue;
+        InfoT bottom, init;
+        Analysis A(bottom, init);
+        A.setInterning(CheckIntern);
+        A.runWorklistAlgorithm(&F);
+        for (unsigned k = 0; k < CheckEdits; ++k) {
+          int kind;
+          std::vector<llvm::BasicBlock *> changed = edit(F, rng, kind);
+          if (changed.empty())
+            continue;
+          ++edits;
+          if (!A.rerunWorklistAlgorithm(&F, changed))
+            ++fallbacks;
+
+          InfoT freshBottom, freshInit;
+          Analysis fresh(freshBottom, freshInit);
+          fresh.setInterning(CheckIntern);
+          fresh.runWorklistAlgorithm(&F);
+          if (printed(A) != printed(fresh)) {
+            llvm::errs() << "mismatch: " << F.getName() << " after edit " << k << " (" << editName(kind) << ")\n";
+            ++mismatches;
+          }
+        }
+      }
+      llvm::errs() << name << ": " << edits << " edits, " << fallbacks << " full reruns, "
+                   << mismatches << " mismatches\n";
+      return mismatches;
+    }
+};
+
+#endif
@@ -0,0 +1,159 @@
+#!/usr/bin/env python3
+"""Run the dataflow passes over the synthetic modules of gen_ir.py.
+
+For every shape, size and pass it reports the wall time and peak RSS of opt,
+and the worklist pops and flow function calls summed over the functions (read
+from the -<pass>-stats-json report of the pass).
+
+    run_bench.py --reaching part2/reaching.so --part3 part3/dfa.so
+    run_bench.py ... --sizes 1000,10000,100000,1000000 --out results.tsv
+    run_bench.py ... --baseline bench/baseline.tsv
+
+The visit counts are deterministic, so any change to them against the
+baseline is reported. Times and RSS are reported when they exceed the
+baseline by more than --tolerance. The exit status is 1 if anything was
+reported, so the script can gate a change.
+"""
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+import gen_ir
+
+PASSES = ['reaching', 'liveness', 'maypointto']
+COLUMNS = ['shape', 'size', 'pass', 'wall_s', 'rss_mb', 'pops', 'flow_calls']
+EXACT = ['pops', 'flow_calls']
+MEASURED = ['wall_s', 'rss_mb']
+
+
+def module_path(workdir, shape, size, func_size, llvm_as):
+    """Generate the module once and keep it in workdir."""
+    path = os.path.join(workdir, '%s-%d.bc' % (shape, size))
+    if not os.path.exists(path):
+        text = gen_ir.generate(shape, size, func_size)
+        subprocess.run([llvm_as, '-', '-o', path], input=text.encode(), check=True)
+    return path
+
+
+def opt_flags(opt):
+    """Legacy pass manager flags, which newer versions of opt need for -load."""
+    help_text = subprocess.run([opt, '--help-hidden'], capture_output=True, text=True).stdout
+    return ['-enable-new-pm=0'] if 'enable-new-pm' in help_text else []
+
+
+def run_pass(args, plugin, name, module, workdir):
+    stats = os.path.join(workdir, 'stats.json')
+    if os.path.exists(stats):
+        os.remove(stats)
+    cmd = [args.opt] + args.flags + ['-load', plugin, '-cse231-' + name, '-disable-output',
+                                     '-%s-stats-json=%s' % (name, stats), module]
+
+    start = time.monotonic()
+    with open(os.devnull, 'w') as devnull:
+        proc = subprocess.Popen(cmd, stdout=devnull, stderr=devnull)
+        _, status, usage = os.wait4(proc.pid, 0)
+    wall = time.monotonic() - start
+    if status != 0:
+        sys.exit('error: %s failed on %s' % (name, module))
+
+    pops = calls = 0
+    with open(stats) as f:
+        for line in f:
+            record = json.loads(line)
+            pops += record['pops']
+            calls += record['flow_calls']
+    # ru_maxrss is in kilobytes on Linux
+    return {'wall_s': '%.3f' % wall, 'rss_mb': '%.1f' % (usage.ru_maxrss / 1024.0),
+            'pops': str(pops), 'flow_calls': str(calls)}
+
+
+def read_table(path):
+    rows = {}
+    with open(path) as f:
+        header = f.readline().rstrip('\n').split('\t')
+        for line in f:
+            row = dict(zip(header, line.rstrip('\n').split('\t')))
+            rows[(row['shape'], row['size'], row['pass'])] = row
+    return rows
+
+
+def compare(rows, baseline, tolerance):
+    """Print the differences against the baseline; return how many there are."""
+    problems = 0
+    for row in rows:
+        key = (row['shape'], row['size'], row['pass'])
+        old = baseline.get(key)
+        if old is None:
+            continue
+        name = '%s/%s/%s' % key
+        for col in EXACT:
+            if row[col] != old[col]:
+                print('%s: %s %s -> %s' % (name, col, old[col], row[col]))
+                problems += 1
+        for col in MEASURED:
+            before, after = float(old[col]), float(row[col])
+            if after > before * (1 + tolerance) and after - before > 0.05:
+                print('%s: %s %s -> %s (+%.0f%%)' % (name, col, old[col], row[col],
+                                                   100 * (after / before - 1) if before else 100))
+                problems += 1
+    return problems
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Benchmark the dataflow passes.')
+    parser.add_argument('--reaching', help='plugin with cse231-reaching (part2)')
+    parser.add_argument('--part3', help='plugin with cse231-liveness and cse231-maypointto')
+    parser.add_argument('--liveness', help='plugin with cse231-liveness, if not --part3')
+    parser.add_argument('--maypointto', help='plugin with cse231-maypointto, if not --part3')
+    parser.add_argument('--shapes', default=','.join(sorted(gen_ir.SHAPES)))
+    parser.add_argument('--sizes', default='1000,10000,100000')
+    parser.add_argument('--func-size', type=int, default=2000)
+    parser.add_argument('--opt', default='opt')
+    parser.add_argument('--llvm-as', default='llvm-as')
+    parser.add_argument('--workdir', help='where the generated modules are kept')
+    parser.add_argument('--out', help='write the results to this file (tab separated)')
+    parser.add_argument('--baseline', help='compare the results with this file')
+    parser.add_argument('--tolerance', type=float, default=0.25,
+                        help='allowed relative growth of time and RSS')
+    args = parser.parse_args()
+
+    plugins = {'reaching': args.reaching,
+               'liveness': args.liveness or args.part3,
+               'maypointto': args.maypointto or args.part3}
+    passes = [p for p in PASSES if plugins[p]]
+    if not passes:
+        sys.exit('error: no plugin given')
+    args.flags = opt_flags(args.opt)
+    workdir = args.workdir or tempfile.mkdtemp(prefix='cse231-bench-')
+    os.makedirs(workdir, exist_ok=True)
+
+    rows = []
+    print('\t'.join(COLUMNS))
+    for shape in args.shapes.split(','):
+        for size in [int(s) for s in args.sizes.split(',')]:
+            module = module_path(workdir, shape, size, args.func_size, args.llvm_as)
+            for name in passes:
+                row = {'shape': shape, 'size': str(size), 'pass': name}
+                row.update(run_pass(args, plugins[name], name, module, workdir))
+                rows.append(row)
+                print('\t'.join(row[c] for c in COLUMNS), flush=True)
+
+    if args.out:
+        with open(args.out, 'w') as f:
+            f.write('\t'.join(COLUMNS) + '\n')
+            for row in rows:
+                f.write('\t'.join(row[c] for c in COLUMNS) + '\n')
+
+    if args.baseline:
+        if compare(rows, read_table(args.baseline), args.tolerance):
+            sys.exit(1)
+        print('no regression against %s' % args.baseline)
+
+
+if __name__ == '__main__':
+    main()
@@ -2,32 +2,78 @@
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/IR/InstIterator.h"
+#include "ExitReport.h"
+#include "EdgeProfile.h"
+#include <memory>
 
 
 
 using namespace llvm;
 using namespace std;
 
+static cl::opt<bool> PrintAtExit("bb-print-at-exit",
+    cl::desc("Print the branch counts once when the program exits instead of at every return"));
+
+static cl::opt<std::string> EdgeProfileMap("bb-edge-profile", cl::value_desc("map file"),
+    cl::desc("Count only the edges off a maximum spanning tree of each CFG, print them at exit, "
+             "and describe the edges in this file, for edge_counts.py"));
+
 namespace {
 struct BranchBias : public FunctionPass {
   static char ID;
+  // The edge map of -bb-edge-profile
+  std::unique_ptr<raw_fd_ostream> Map;
+
   BranchBias() : FunctionPass(ID) {}
+
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    if (!EdgeProfileMap.empty())
+      AU.addRequired<LoopInfoWrapperPass>();
+  }
+
+  bool doInitialization(Module &) override {
+    if (EdgeProfileMap.empty())
+      return false;
+    std::error_code EC;
+    Map.reset(new raw_fd_ostream(EdgeProfileMap, EC, sys::fs::OF_Text));
+    if (EC) {
+      errs() << "error: cannot open " << EdgeProfileMap << ": " << EC.message() << "\n";
+      Map.reset();
+      return false;
+    }
+    *Map << "profile\tcse231-bb\n";
+    return false;
+  }
+
+  bool doFinalization(Module &) override {
+    Map.reset();
+    return false;
+  }
   
   bool runOnFunction(Function &F) override {
+    if (F.getName().startswith("cse231.bb."))
+      return false;
+    if (!EdgeProfileMap.empty())
+      return Map && instrumentEdges(F, getAnalysis<LoopInfoWrapperPass>().getLoopInfo(), "cse231.bb", *Map);
+
     Module *M = F.getParent();
     /* define functions */
-    Function * update = cast<Function>(M->getOrInsertFunction("updateBranchInfo", 
-                                                                Type::getVoidTy(M->getContext()), 
-                                                                Type::getInt1Ty(M->getContext()))); // bool
-    Function * print = cast<Function>(M->getOrInsertFunction("printOutBranchInfo", Type::getVoidTy(M->getContext())));
+    FunctionCallee update = M->getOrInsertFunction("updateBranchInfo", 
+                                                   Type::getVoidTy(M->getContext()), 
+                                                   Type::getInt1Ty(M->getContext())); // bool
+    FunctionCallee print = M->getOrInsertFunction("printOutBranchInfo", Type::getVoidTy(M->getContext()));
+    if (PrintAtExit)
+      registerExitReport(*M, "cse231.bb", nullptr, print);
 
     for (Function::iterator B = F.begin(); B != F.end(); ++B){
       for (BasicBlock::iterator I = B->begin(); I != B->end(); ++I){
         int code = I->getOpcode();
 
-        if (code == 1){ // "return"
+        if (code == 1 && !PrintAtExit){ // "return"
           /* print - before instruction I*/
           IRBuilder<> builder(&*I);
           builder.CreateCall(print);          
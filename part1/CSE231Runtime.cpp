@@ -0,0 +1,462 @@
+/*
+ * Runtime of the part 1 instrumentation passes, linked into the instrumented
+ * programs:
+ *   cse231-cdi: updateInstrInfo_test(opcode, count), printOutInstrInfo()
+ *   cse231-bb:  updateBranchInfo(taken), printOutBranchInfo()
+ *   -bb-edge-profile, -cdi-edge-profile: printOutEdgeCounts(function, counts, n)
+ *   cse231-paths: printOutPathCounts(function, counts, n), and for the functions
+ *                 with too many paths for an array updatePathCount(id, path),
+ *                 printOutPathTable(function, id)
+ *   inline counters (ThreadCounters.h): registerThreadCounters(local, shared, n),
+ *                 flushThreadCounters()
+ *   the report at exit (ExitReport.h): registerExitReport(run, print)
+ *
+ * Each thread counts into its own shard, so the update calls take no lock and
+ * do not share cache lines. A thread takes a shard on its first update; when it
+ * exits, the shard is added to the totals of the exited threads and handed to
+ * the next new thread. The print calls add up those totals and the shards of the
+ * running threads, and report what was counted since the previous print, as the
+ * course library did.
+ *
+ * The opcode names come from llvm/IR/Instruction.def, so the runtime does not
+ * link against LLVM.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+const char * const OpcodeEnums[] = {
+  "",
+#define HANDLE_INST(N, OPC, CLASS) #OPC,
+#include "llvm/IR/Instruction.def"
+};
+
+const unsigned NumOpcodes = sizeof(OpcodeEnums) / sizeof(OpcodeEnums[0]);
+
+/* The name Instruction::getOpcodeName gives: the enumerator in lower case, but for a few */
+string opcodeName(unsigned opcode) {
+  string name = OpcodeEnums[opcode];
+  if (name == "AtomicCmpXchg")
+    return "cmpxchg";
+  if (name == "VAArg")
+    return "va_arg";
+  if (name.compare(0, 6, "UserOp") == 0)
+    return "<Invalid operator>";
+  for (char & c : name)
+    c = tolower(c);
+  return name;
+}
+
+// Count of each path of a function
+typedef unordered_map<uint64_t, uint64_t> PathCounts;
+
+/* Owner-only increment: a plain load and store, no locked instruction */
+inline void bump(atomic<uint64_t> & counter, uint64_t n) {
+  counter.store(counter.load(memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+/*
+ * The hashed path counts of one thread, by function id and path: an open
+ * addressing table that only the owner writes, without a lock. A slot is
+ * published by storing its function last; function 0 marks a free slot. Growing
+ * replaces the slots, so the owner swaps them under Lock, and the printing
+ * threads read them under it.
+ */
+struct PathTable {
+  struct Slot {
+    atomic<uint64_t> Function;
+    atomic<uint64_t> Path;
+    atomic<uint64_t> Count;
+  };
+
+  mutex Lock;
+  Slot * Slots = nullptr;
+  unsigned Shift = 64; // a key goes to slot hash >> Shift
+  size_t Used = 0;
+
+  size_t size() const { return Slots ? size_t(1) << (64 - Shift) : 0; }
+
+  /* The slot of a key in slots, or the free slot where it goes. They must not be full. */
+  static Slot * find(Slot * slots, unsigned shift, uint64_t function, uint64_t path) {
+    size_t mask = (size_t(1) << (64 - shift)) - 1;
+    size_t i = ((function ^ path * 0x9e3779b97f4a7c15) * 0xff51afd7ed558ccd) >> shift;
+    for (;; i = (i + 1) & mask) {
+      uint64_t f = slots[i].Function.load(memory_order_relaxed);
+      if (f == 0 || (f == function && slots[i].Path.load(memory_order_relaxed) == path))
+        return &slots[i];
+    }
+  }
+
+  /* Owner only: double the slots once they are three quarters used */
+  void grow() {
+    unsigned shift = Slots ? Shift - 1 : 64 - 10;
+    Slot * slots = new Slot[size_t(1) << (64 - shift)]();
+    for (size_t i = 0; i < size(); ++i) {
+      uint64_t f = Slots[i].Function.load(memory_order_relaxed);
+      if (!f)
+        continue;
+      uint64_t path = Slots[i].Path.load(memory_order_relaxed);
+      Slot * slot = find(slots, shift, f, path);
+      slot->Path.store(path, memory_order_relaxed);
+      slot->Count.store(Slots[i].Count.load(memory_order_relaxed), memory_order_relaxed);
+      slot->Function.store(f, memory_order_relaxed);
+    }
+    lock_guard<mutex> lock(Lock);
+    delete[] Slots;
+    Slots = slots;
+    Shift = shift;
+  }
+
+  /* Owner only */
+  void add(uint64_t function, uint64_t path) {
+    if (Slots) {
+      Slot * slot = find(Slots, Shift, function, path);
+      if (slot->Function.load(memory_order_relaxed)) {
+        bump(slot->Count, 1);
+        return;
+      }
+    }
+    if ((Used + 1) * 4 > size() * 3)
+      grow();
+    Slot * slot = find(Slots, Shift, function, path);
+    slot->Path.store(path, memory_order_relaxed);
+    slot->Count.store(1, memory_order_relaxed);
+    slot->Function.store(function, memory_order_release);
+    ++Used;
+  }
+
+  /* Add the counts of function, or of every function if it is 0 */
+  void addTo(uint64_t function, map<uint64_t, PathCounts> & totals) {
+    lock_guard<mutex> lock(Lock);
+    for (size_t i = 0; i < size(); ++i) {
+      uint64_t f = Slots[i].Function.load(memory_order_acquire);
+      if (f && (f == function || function == 0))
+        totals[f][Slots[i].Path.load(memory_order_relaxed)] += Slots[i].Count.load(memory_order_relaxed);
+    }
+  }
+
+  void clear() {
+    lock_guard<mutex> lock(Lock);
+    for (size_t i = 0; i < size(); ++i)
+      Slots[i].Function.store(0, memory_order_relaxed);
+    Used = 0;
+  }
+};
+
+/*
+ * The thread-local copy of an array of inline counters, the shared array it goes
+ * into, and the part of the copy already added there. Only the owner thread
+ * writes the copy, so it is read with relaxed atomic loads.
+ */
+struct LocalCounters {
+  uint64_t * Local;
+  uint64_t * Shared;
+  vector<uint64_t> Added;
+
+  /* Add what was counted since the last time. The registry lock must be held. */
+  void flush() {
+    for (size_t i = 0; i < Added.size(); ++i) {
+      uint64_t count = __atomic_load_n(&Local[i], __ATOMIC_RELAXED);
+      Shared[i] += count - Added[i];
+      Added[i] = count;
+    }
+  }
+};
+
+/*
+ * Counters of one thread. Only the owner writes them; printing threads read them.
+ * The padding keeps the counters of two shards off the same cache line.
+ */
+struct Shard {
+  char Before[64];
+  atomic<uint64_t> Instr[NumOpcodes];
+  atomic<uint64_t> Taken;
+  atomic<uint64_t> Branches;
+  PathTable Paths;
+  // The inline counters of the thread. The registry lock guards them.
+  vector<LocalCounters> Counters;
+  char After[64];
+
+  Shard() { clear(); }
+
+  void clear() {
+    for (unsigned i = 0; i < NumOpcodes; ++i)
+      Instr[i].store(0, memory_order_relaxed);
+    Taken.store(0, memory_order_relaxed);
+    Branches.store(0, memory_order_relaxed);
+    Counters.clear();
+    Paths.clear();
+  }
+};
+
+struct Totals {
+  uint64_t Instr[NumOpcodes] = {};
+  uint64_t Taken = 0;
+  uint64_t Branches = 0;
+
+  void add(const Shard & shard) {
+    for (unsigned i = 0; i < NumOpcodes; ++i)
+      Instr[i] += shard.Instr[i].load(memory_order_relaxed);
+    Taken += shard.Taken.load(memory_order_relaxed);
+    Branches += shard.Branches.load(memory_order_relaxed);
+  }
+};
+
+/*
+ * The shards of the running threads, the free ones, and the counts of the threads
+ * that exited. It is never destroyed, since threads may still count while the
+ * process exits.
+ */
+struct Registry {
+  mutex Lock;
+  vector<Shard *> Live;
+  vector<Shard *> Free;
+  Totals Exited;
+  map<uint64_t, PathCounts> ExitedPaths;
+  // What the previous prints reported
+  Totals Printed;
+
+  /* Everything counted so far. Lock must be held. */
+  Totals sum() {
+    Totals totals = Exited;
+    for (Shard * shard : Live)
+      totals.add(*shard);
+    return totals;
+  }
+};
+
+Registry & registry() {
+  static Registry * r = new Registry();
+  return *r;
+}
+
+/*
+ * The report at exit of the whole program: the functions that each module
+ * registered, in order. The first registration installs the one atexit handler.
+ */
+struct ExitReport {
+  mutex Lock;
+  vector<void (*)()> Runs;
+  vector<void (*)()> Prints; // without duplicates
+  bool Installed = false;
+};
+
+ExitReport & exitReport() {
+  static ExitReport * report = new ExitReport();
+  return *report;
+}
+
+thread_local Shard * Current = nullptr;
+thread_local bool ThreadExited = false;
+
+/* Give the shard of a thread back when it exits */
+struct ShardOwner {
+  ~ShardOwner() {
+    Registry & r = registry();
+    lock_guard<mutex> lock(r.Lock);
+    r.Exited.add(*Current);
+    // The copies go away with the thread. If it counts again, it registers again.
+    for (LocalCounters & counters : Current->Counters) {
+      counters.flush();
+      counters.Local[counters.Added.size()] = 0;
+    }
+    Current->Paths.addTo(0, r.ExitedPaths);
+    Current->clear();
+    for (unsigned i = 0; i < r.Live.size(); ++i) {
+      if (r.Live[i] == Current) {
+        r.Live[i] = r.Live.back();
+        r.Live.pop_back();
+        break;
+      }
+    }
+    r.Free.push_back(Current);
+    Current = nullptr;
+    ThreadExited = true;
+  }
+};
+
+/* The first update of a thread */
+Shard * acquire() {
+  Registry & r = registry();
+  {
+    lock_guard<mutex> lock(r.Lock);
+    if (r.Free.empty()) {
+      Current = new Shard();
+    } else {
+      Current = r.Free.back();
+      r.Free.pop_back();
+    }
+    r.Live.push_back(Current);
+  }
+  // A thread that counts again in thread-exit destructors run after ours keeps
+  // its new shard
+  if (!ThreadExited) {
+    thread_local ShardOwner owner;
+    (void)owner;
+  }
+  return Current;
+}
+
+inline Shard & shard() {
+  Shard * s = Current;
+  return s ? *s : *acquire();
+}
+
+/* "paths\t<function>\t<path>:<count> ...", for decode_paths.py */
+void printPaths(const char * function, const vector<pair<uint64_t, uint64_t>> & counts) {
+  string out = string("paths\t") + function + '\t';
+  for (unsigned i = 0; i < counts.size(); ++i)
+    out += (i ? " " : "") + to_string(counts[i].first) + ':' + to_string(counts[i].second);
+  out += '\n';
+  fwrite(out.data(), 1, out.size(), stderr);
+}
+
+} // end of anonymous namespace
+
+extern "C" {
+
+void updateInstrInfo_test(uint32_t opcode, uint32_t count) {
+  if (opcode < NumOpcodes)
+    bump(shard().Instr[opcode], count);
+}
+
+void printOutInstrInfo() {
+  Registry & r = registry();
+  string out;
+  {
+    lock_guard<mutex> lock(r.Lock);
+    Totals totals = r.sum();
+    for (unsigned i = 1; i < NumOpcodes; ++i) {
+      uint64_t count = totals.Instr[i] - r.Printed.Instr[i];
+      if (count)
+        out += opcodeName(i) + '\t' + to_string(count) + '\n';
+      r.Printed.Instr[i] = totals.Instr[i];
+    }
+  }
+  fwrite(out.data(), 1, out.size(), stderr);
+}
+
+/* The passes pass an i1 without zeroext, so only the low bit is defined */
+void updateBranchInfo(uint8_t taken) {
+  Shard & s = shard();
+  bump(s.Taken, taken & 1);
+  bump(s.Branches, 1);
+}
+
+void printOutBranchInfo() {
+  Registry & r = registry();
+  string out;
+  {
+    lock_guard<mutex> lock(r.Lock);
+    Totals totals = r.sum();
+    out += "taken\t" + to_string(totals.Taken - r.Printed.Taken) + '\n';
+    out += "total\t" + to_string(totals.Branches - r.Printed.Branches) + '\n';
+    r.Printed.Taken = totals.Taken;
+    r.Printed.Branches = totals.Branches;
+  }
+  fwrite(out.data(), 1, out.size(), stderr);
+}
+
+/*
+ * The edge counters of one function, counted inline by the instrumented code:
+ * "edges\t<function>\t<count> <count> ...", for edge_counts.py
+ */
+void printOutEdgeCounts(const char * function, const uint64_t * counts, uint32_t n) {
+  string out = string("edges\t") + function + '\t';
+  for (uint32_t i = 0; i < n; ++i)
+    out += (i ? " " : "") + to_string(counts[i]);
+  out += '\n';
+  fwrite(out.data(), 1, out.size(), stderr);
+}
+
+/* The first time a function with inline counters runs in a thread */
+void registerThreadCounters(uint64_t * local, uint64_t * shared, uint32_t n) {
+  Shard & s = shard();
+  Registry & r = registry();
+  lock_guard<mutex> lock(r.Lock);
+  s.Counters.push_back({local, shared, vector<uint64_t>(local, local + n)});
+  local[n] = 1;
+}
+
+/* Bring the shared arrays of inline counters up to date, before they are printed */
+void flushThreadCounters() {
+  Registry & r = registry();
+  lock_guard<mutex> lock(r.Lock);
+  for (Shard * shard : r.Live)
+    for (LocalCounters & counters : shard->Counters)
+      counters.flush();
+}
+
+/* The atexit handler: flush, run what the modules registered, and print once */
+static void runExitReport() {
+  ExitReport & report = exitReport();
+  vector<void (*)()> runs, prints;
+  {
+    lock_guard<mutex> lock(report.Lock);
+    runs = report.Runs;
+    prints = report.Prints;
+  }
+  flushThreadCounters();
+  for (auto run : runs)
+    run();
+  for (auto print : prints)
+    print();
+}
+
+/* From the constructor of each instrumented module; run and print may be null */
+void registerExitReport(void (*run)(), void (*print)()) {
+  ExitReport & report = exitReport();
+  lock_guard<mutex> lock(report.Lock);
+  if (!report.Installed) {
+    atexit(runExitReport);
+    report.Installed = true;
+  }
+  if (run)
+    report.Runs.push_back(run);
+  if (print && find(report.Prints.begin(), report.Prints.end(), print) == report.Prints.end())
+    report.Prints.push_back(print);
+}
+
+/* The path counts of a function with an array of them */
+void printOutPathCounts(const char * function, const uint64_t * counts, uint32_t n) {
+  vector<pair<uint64_t, uint64_t>> paths;
+  for (uint32_t i = 0; i < n; ++i)
+    if (counts[i])
+      paths.push_back({i, counts[i]});
+  printPaths(function, paths);
+}
+
+/* id is the nonzero id that cse231-paths gave the function */
+void updatePathCount(uint64_t id, uint64_t path) {
+  shard().Paths.add(id, path);
+}
+
+/* The path counts of a function counted by updatePathCount */
+void printOutPathTable(const char * function, uint64_t id) {
+  Registry & r = registry();
+  map<uint64_t, PathCounts> totals;
+  {
+    lock_guard<mutex> lock(r.Lock);
+    totals[id] = r.ExitedPaths[id];
+    for (Shard * shard : r.Live)
+      shard->Paths.addTo(id, totals);
+  }
+  vector<pair<uint64_t, uint64_t>> paths(totals[id].begin(), totals[id].end());
+  sort(paths.begin(), paths.end());
+  printPaths(function, paths);
+}
+
+}
@@ -2,26 +2,79 @@
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/IR/InstIterator.h"
+#include "ExitReport.h"
+#include "EdgeProfile.h"
+#include "ThreadCounters.h"
+#include <memory>
 
 using namespace llvm;
 using namespace std;
 
+static cl::opt<bool> InlineCounters("cdi-inline-counters",
+    cl::desc("Count executed blocks inline and fold the counts into the opcode totals once, at exit"));
+
+static cl::opt<bool> PrintAtExit("cdi-print-at-exit",
+    cl::desc("Print the instruction counts once when the program exits instead of at every return "
+             "(-cdi-inline-counters always does)"));
+
+static cl::opt<std::string> EdgeProfileMap("cdi-edge-profile", cl::value_desc("map file"),
+    cl::desc("Count only the edges off a maximum spanning tree of each CFG, print them at exit, "
+             "and describe the edges and blocks in this file, for edge_counts.py"));
+
 namespace {
 struct CountDynamicInstructions : public FunctionPass {
   static char ID;
+  // The edge map of -cdi-edge-profile
+  std::unique_ptr<raw_fd_ostream> Map;
+
   CountDynamicInstructions() : FunctionPass(ID) {}
+
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    if (!EdgeProfileMap.empty())
+      AU.addRequired<LoopInfoWrapperPass>();
+  }
+
+  bool doInitialization(Module &) override {
+    if (EdgeProfileMap.empty())
+      return false;
+    std::error_code EC;
+    Map.reset(new raw_fd_ostream(EdgeProfileMap, EC, sys::fs::OF_Text));
+    if (EC) {
+      errs() << "error: cannot open " << EdgeProfileMap << ": " << EC.message() << "\n";
+      Map.reset();
+      return false;
+    }
+    *Map << "profile\tcse231-cdi\n";
+    return false;
+  }
+
+  bool doFinalization(Module &) override {
+    Map.reset();
+    return false;
+  }
   
   bool runOnFunction(Function &F) override {
+    if (F.getName().startswith("cse231.cdi."))
+      return false;
+    if (!EdgeProfileMap.empty())
+      return Map && instrumentEdges(F, getAnalysis<LoopInfoWrapperPass>().getLoopInfo(), "cse231.cdi", *Map);
+    if (InlineCounters)
+      return instrumentInline(F);
+
     Module *M = F.getParent();
 
     /* define functions */
-    Function * update = cast<Function>(M->getOrInsertFunction("updateInstrInfo_test", 
-                                                                Type::getVoidTy(M->getContext()), 
-                                                                Type::getInt32Ty(M->getContext()), 
-                                                                Type::getInt32Ty(M->getContext())));
-    Function * print = cast<Function>(M->getOrInsertFunction("printOutInstrInfo", Type::getVoidTy(M->getContext())));
+    FunctionCallee update = M->getOrInsertFunction("updateInstrInfo_test", 
+                                                   Type::getVoidTy(M->getContext()), 
+                                                   Type::getInt32Ty(M->getContext()), 
+                                                   Type::getInt32Ty(M->getContext()));
+    FunctionCallee print = M->getOrInsertFunction("printOutInstrInfo", Type::getVoidTy(M->getContext()));
+    if (PrintAtExit)
+      registerExitReport(*M, "cse231.cdi", nullptr, print);
 
     for (Function::iterator B = F.begin(); B != F.end(); ++B){
       map<int, int> dict;
@@ -43,7 +96,8 @@ struct CountDynamicInstructions : public FunctionPass {
             builder.CreateCall(update, args);
           }
           /* print */
-          builder.CreateCall(print);
+          if (!PrintAtExit)
+            builder.CreateCall(print);
 
         }
 
@@ -63,10 +117,164 @@ struct CountDynamicInstructions : public FunctionPass {
 
     return true;
   }
+
+  /*
+   * Inline counter mode: each block only increments its counter, in a copy of
+   * the counters of F for each thread (ThreadCounters.h), and its opcode
+   * histogram goes to a constant table. When the program exits, cse231.cdi.fold
+   * reports counter x histogram for every block of the module through
+   * updateInstrInfo_test. The fold calls the fold of the function instrumented
+   * last, which calls the one before it, and so on. The exit report runs the
+   * fold of every module of the program, and then printOutInstrInfo prints one
+   * table of totals. A fold costs a pass over every block of its module, so it
+   * only runs once, whether or not -cdi-print-at-exit is given.
+   */
+  bool instrumentInline(Function &F) {
+    Module *M = F.getParent();
+
+    LLVMContext &C = M->getContext();
+    Type * i32 = Type::getInt32Ty(C);
+
+    Function * fold = cast<Function>(M->getOrInsertFunction("cse231.cdi.fold", Type::getVoidTy(C)).getCallee());
+    FunctionCallee print = M->getOrInsertFunction("printOutInstrInfo", Type::getVoidTy(C));
+
+    ThreadCounters counts = createThreadCounters(*M, F.size(), "cse231.cdi.counts");
+    Type * countsTy = counts.Shared->getValueType();
+
+    vector<Constant *> rows;    // {counter, first histogram entry, end of its entries}
+    vector<Constant *> entries; // {opcode, count}
+    unsigned index = 0;
+    for (Function::iterator B = F.begin(); B != F.end(); ++B, ++index){
+      map<int, int> dict;
+      for (BasicBlock::iterator I = B->begin(); I != B->end(); ++I)
+        dict[I->getOpcode()] += 1;
+
+      Constant * indices[] = {ConstantInt::get(i32, 0), ConstantInt::get(i32, index)};
+      Constant * counter = ConstantExpr::getInBoundsGetElementPtr(countsTy, counts.Shared, indices);
+      unsigned first = entries.size();
+      for (map<int,int>::iterator it=dict.begin(); it!=dict.end(); ++it){
+        Constant * entry[] = {ConstantInt::get(i32, it->first), ConstantInt::get(i32, it->second)};
+        entries.push_back(ConstantStruct::getAnon(entry));
+      }
+      Constant * row[] = {counter, ConstantInt::get(i32, first), ConstantInt::get(i32, entries.size())};
+      rows.push_back(ConstantStruct::getAnon(row));
+
+      /* counter += 1 - before the terminator, where the calls went */
+      IRBuilder<> builder(B->getTerminator());
+      incrementCounter(builder, counts, builder.getInt64(index), builder.getInt64(1));
+    }
+    registerThreadCountersOnEntry(F, counts);
+
+    /* cse231.cdi.fold: call the fold of F, which goes on with the previous one */
+    Function * next = nullptr;
+    if (!fold->empty()) {
+      next = cast<CallInst>(&fold->front().front())->getCalledFunction();
+      fold->deleteBody();
+    }
+    Function * foldF = createFold(F, rows, entries, next);
+    fold->setLinkage(GlobalValue::InternalLinkage);
+    IRBuilder<> builder(BasicBlock::Create(C, "entry", fold));
+    builder.CreateCall(foldF);
+    builder.CreateRetVoid();
+
+    /* the counters of every module are folded once, at exit, before the print */
+    registerExitReport(*M, "cse231.cdi", fold, print);
+
+    return true;
+  }
+
+  /* The fold of the blocks of F, described by rows and entries; it ends by calling next */
+  Function * createFold(Function &F, vector<Constant *> &rows, vector<Constant *> &entries, Function * next) {
+    Module *M = F.getParent();
+    LLVMContext &C = M->getContext();
+    Type * i32 = Type::getInt32Ty(C);
+    Type * i64 = Type::getInt64Ty(C);
+
+    ArrayType * blocksTy = ArrayType::get(rows[0]->getType(), rows.size());
+    ArrayType * histTy = ArrayType::get(entries[0]->getType(), entries.size());
+    GlobalVariable * blocks = new GlobalVariable(*M, blocksTy, true, GlobalValue::PrivateLinkage,
+                                                 ConstantArray::get(blocksTy, rows), "cse231.cdi.blocks");
+    GlobalVariable * hist = new GlobalVariable(*M, histTy, true, GlobalValue::PrivateLinkage,
+                                               ConstantArray::get(histTy, entries), "cse231.cdi.hist");
+
+    FunctionCallee update = M->getOrInsertFunction("updateInstrInfo_test", Type::getVoidTy(C), i32, i32);
+    Function * fold = Function::Create(FunctionType::get(Type::getVoidTy(C), false), GlobalValue::InternalLinkage,
+                                       "cse231.cdi.fold." + F.getName(), M);
+
+    BasicBlock * entry = BasicBlock::Create(C, "entry", fold);
+    BasicBlock * block = BasicBlock::Create(C, "block", fold);
+    BasicBlock * clear = BasicBlock::Create(C, "clear", fold);
+    BasicBlock * entryLoop = BasicBlock::Create(C, "entry.loop", fold);
+    BasicBlock * chunk = BasicBlock::Create(C, "chunk", fold);
+    BasicBlock * nextEntry = BasicBlock::Create(C, "entry.next", fold);
+    BasicBlock * nextBlock = BasicBlock::Create(C, "block.next", fold);
+    BasicBlock * exit = BasicBlock::Create(C, "exit", fold);
+
+    IRBuilder<> builder(entry);
+    builder.CreateBr(block);
+
+    /* for each block b with a nonzero counter c: clear it */
+    builder.SetInsertPoint(block);
+    PHINode * b = builder.CreatePHI(i32, 2);
+    Value * row = builder.CreateInBoundsGEP(blocksTy, blocks, {builder.getInt32(0), b});
+    Type * rowTy = blocksTy->getElementType();
+    Type * counterTy = rowTy->getStructElementType(0);
+    Value * counter = builder.CreateLoad(counterTy, builder.CreateStructGEP(rowTy, row, 0));
+    Value * c = builder.CreateLoad(i64, counter);
+    builder.CreateCondBr(builder.CreateICmpEQ(c, builder.getInt64(0)), nextBlock, clear);
+
+    builder.SetInsertPoint(clear);
+    builder.CreateStore(builder.getInt64(0), counter);
+    Value * first = builder.CreateLoad(i32, builder.CreateStructGEP(rowTy, row, 1));
+    Value * end = builder.CreateLoad(i32, builder.CreateStructGEP(rowTy, row, 2));
+    builder.CreateBr(entryLoop);
+
+    /* for each entry {opcode, n} of its histogram: report c x n */
+    builder.SetInsertPoint(entryLoop);
+    PHINode * k = builder.CreatePHI(i32, 2);
+    Value * e = builder.CreateInBoundsGEP(histTy, hist, {builder.getInt32(0), k});
+    Type * entryTy = histTy->getElementType();
+    Value * opcode = builder.CreateLoad(i32, builder.CreateStructGEP(entryTy, e, 0));
+    Value * n = builder.CreateLoad(i32, builder.CreateStructGEP(entryTy, e, 1));
+    Value * total = builder.CreateMul(c, builder.CreateZExt(n, i64));
+    builder.CreateBr(chunk);
+
+    /* the count argument is an i32, so large totals go in several calls */
+    builder.SetInsertPoint(chunk);
+    PHINode * rest = builder.CreatePHI(i64, 2);
+    Value * max = builder.getInt64(INT32_MAX);
+    Value * part = builder.CreateSelect(builder.CreateICmpUGT(rest, max), max, rest);
+    vector<Value *> args = {opcode, builder.CreateTrunc(part, i32)};
+    builder.CreateCall(update, args);
+    Value * left = builder.CreateSub(rest, part);
+    builder.CreateCondBr(builder.CreateICmpNE(left, builder.getInt64(0)), chunk, nextEntry);
+
+    builder.SetInsertPoint(nextEntry);
+    Value * k1 = builder.CreateAdd(k, builder.getInt32(1));
+    builder.CreateCondBr(builder.CreateICmpULT(k1, end), entryLoop, nextBlock);
+
+    builder.SetInsertPoint(nextBlock);
+    Value * b1 = builder.CreateAdd(b, builder.getInt32(1));
+    builder.CreateCondBr(builder.CreateICmpULT(b1, builder.getInt32(rows.size())), block, exit);
+
+    builder.SetInsertPoint(exit);
+    if (next)
+      builder.CreateCall(next);
+    builder.CreateRetVoid();
+
+    b->addIncoming(builder.getInt32(0), entry);
+    b->addIncoming(b1, nextBlock);
+    k->addIncoming(first, clear);
+    k->addIncoming(k1, nextEntry);
+    rest->addIncoming(total, entryLoop);
+    rest->addIncoming(left, chunk);
+
+    return fold;
+  }
 }; // end of struct CountDynamicInstructions
 }  // end of anonymous namespace
 
 char CountDynamicInstructions::ID = 0;
 static RegisterPass<CountDynamicInstructions> X("cse231-cdi", "Developed to test LLVM and docker",
                              false /* Only looks at CFG */,
-                             false /* Analysis Pass */);
\ No newline at end of file
+                             false /* Analysis Pass */);
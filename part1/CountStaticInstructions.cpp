@@ -2,6 +2,7 @@
 #include "llvm/IR/Function.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/IR/InstIterator.h"
+#include <map>
 
 using namespace llvm;
 using namespace std;
@@ -0,0 +1,265 @@
+#ifndef CSE231_EDGE_PROFILE_H
+#define CSE231_EDGE_PROFILE_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "ExitReport.h"
+#include "ThreadCounters.h"
+
+#include <algorithm>
+#include <map>
+#include <numeric>
+#include <vector>
+
+/*
+ * Spanning-tree edge profiling (Knuth). Add a virtual node V to the CFG of a
+ * function, with an edge V -> entry and an edge B -> V from every block B that
+ * leaves the function. Then every node keeps flow conservation: as many runs
+ * enter it as leave it. So the counts of the edges of a spanning tree follow
+ * from the counts of the other edges, and only those get a counter. The tree is
+ * a maximum spanning tree for weights that grow with the loop depth, and more
+ * for the back edges of a loop, so the counters stay off the edges that run
+ * most. Among equal weights, the tree takes the critical edges, whose counters
+ * would need a block of their own.
+ *
+ * A call that may not return (exit, abort, longjmp, an exception) leaves the
+ * function with the block unfinished, so, as in gcov, a block with such a call,
+ * or that ends in unreachable, also gets a fake edge B -> V. Every run that
+ * enters B then leaves it by a real edge or by the fake one. A fake edge cannot
+ * be counted, so the fake edges go on the tree first and their counts follow
+ * from the others; a real edge is only counted once B has reached it, and the
+ * edge from a ret to V just before the ret. A function that calls a function
+ * that returns twice (setjmp) is not instrumented.
+ *
+ * The counters are inline increments of an array of the function, which each
+ * thread counts into a copy of (ThreadCounters.h). <prefix>.dump runs at exit
+ * and passes every array to printOutEdgeCounts. The map file describes the edges
+ * and blocks of each function, and edge_counts.py derives the block and edge
+ * counts from it and the program output.
+ *
+ * A function with a terminator other than br, switch, ret or unreachable is not
+ * instrumented either; the map lists both as unprofiled.
+ */
+
+struct ProfileEdge {
+  unsigned From, To; // block indices; V is the number of blocks
+  uint64_t Weight;
+  int Counter;       // -1 on the spanning tree
+  bool Fake;         // B -> V, taken when a call of B does not return
+};
+
+/* Whether I is a call that may leave the function without returning */
+static inline bool mayNotReturn(const llvm::Instruction & I) {
+  const llvm::CallBase * call = llvm::dyn_cast<llvm::CallBase>(&I);
+  return call && !(call->hasFnAttr(llvm::Attribute::WillReturn) && call->doesNotThrow());
+}
+
+/* Edge weight: 8^loop depth, 4 times that for a back edge, doubled, plus one for a critical edge */
+static inline uint64_t edgeWeight(unsigned depth, bool backEdge, bool critical) {
+  return (uint64_t(1) << (3 * std::min(depth, 20u))) * (backEdge ? 4 : 1) * 2 + critical;
+}
+
+/*
+ * Where code for the edge B -> S can go without a new block: the bottom of B if S
+ * is its one successor, the top of S if B is its one predecessor. Null otherwise.
+ */
+static inline llvm::Instruction * edgeInsertionPoint(llvm::BasicBlock * B, llvm::BasicBlock * S) {
+  if (B->getUniqueSuccessor())
+    return B->getTerminator();
+  if (S->getUniquePredecessor())
+    return &*S->getFirstInsertionPt();
+  return nullptr;
+}
+
+static inline unsigned findRoot(std::vector<unsigned> & parent, unsigned n) {
+  while (parent[n] != n)
+    n = parent[n] = parent[parent[n]];
+  return n;
+}
+
+/*
+ * Profile the edges of F, whose counters the report of prefix prints at exit, and
+ * describe it in map. Returns whether F was changed.
+ */
+static inline bool instrumentEdges(llvm::Function &F, llvm::LoopInfo &LI, llvm::StringRef prefix,
+                                   llvm::raw_ostream &map) {
+  llvm::Module *M = F.getParent();
+  std::string key = M->getModuleIdentifier() + ":" + F.getName().str();
+  for (llvm::BasicBlock &B : F) {
+    unsigned opcode = B.getTerminator()->getOpcode();
+    if (opcode != llvm::Instruction::Br && opcode != llvm::Instruction::Switch &&
+        opcode != llvm::Instruction::Ret && opcode != llvm::Instruction::Unreachable) {
+      map << "unprofiled\t" << key << "\n";
+      return false;
+    }
+    for (llvm::Instruction &I : B)
+      if (llvm::CallBase * call = llvm::dyn_cast<llvm::CallBase>(&I))
+        if (call->hasFnAttr(llvm::Attribute::ReturnsTwice)) {
+          map << "unprofiled\t" << key << "\n";
+          return false;
+        }
+  }
+
+  std::vector<llvm::BasicBlock *> blocks;
+  llvm::DenseMap<llvm::BasicBlock *, unsigned> index;
+  for (llvm::BasicBlock &B : F) {
+    index[&B] = blocks.size();
+    blocks.push_back(&B);
+  }
+  unsigned V = blocks.size();
+
+  /* the edges, with duplicate successors merged; V -> entry comes first */
+  std::vector<ProfileEdge> edges;
+  edges.push_back({V, 0, edgeWeight(0, false, false), -1, false});
+  for (unsigned i = 0; i < V; ++i) {
+    llvm::BasicBlock * B = blocks[i];
+    llvm::SmallVector<llvm::BasicBlock *, 4> succs;
+    for (llvm::BasicBlock * S : llvm::successors(B))
+      if (std::find(succs.begin(), succs.end(), S) == succs.end())
+        succs.push_back(S);
+    if (llvm::isa<llvm::ReturnInst>(B->getTerminator()))
+      edges.push_back({i, V, edgeWeight(LI.getLoopDepth(B), false, false), -1, false});
+    if (llvm::isa<llvm::UnreachableInst>(B->getTerminator()) ||
+        std::any_of(B->begin(), B->end(), mayNotReturn))
+      edges.push_back({i, V, 0, -1, true});
+    for (llvm::BasicBlock * S : succs) {
+      bool critical = succs.size() > 1 && !S->getUniquePredecessor();
+      unsigned depth = std::min(LI.getLoopDepth(B), LI.getLoopDepth(S));
+      bool backEdge = LI.isLoopHeader(S) && LI.getLoopFor(S)->contains(B);
+      edges.push_back({i, index[S], edgeWeight(depth, backEdge, critical), -1, false});
+    }
+  }
+
+  /* Kruskal: the fake edges, then the heaviest edges that close no cycle form the tree */
+  std::vector<unsigned> order(edges.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](unsigned a, unsigned b) {
+    if (edges[a].Fake != edges[b].Fake)
+      return edges[a].Fake;
+    return edges[a].Weight > edges[b].Weight;
+  });
+  std::vector<unsigned> parent(V + 1);
+  std::iota(parent.begin(), parent.end(), 0);
+  int numCounters = 0;
+  for (unsigned e : order) {
+    unsigned from = findRoot(parent, edges[e].From), to = findRoot(parent, edges[e].To);
+    if (from != to)
+      parent[from] = to;
+    else
+      edges[e].Counter = numCounters++;
+  }
+
+  /*
+   * A conditional br is taken along the edge to its first successor, unless both
+   * successors are the same block; then its condition is counted directly.
+   */
+  std::map<unsigned, unsigned> takenEdge;
+  std::map<unsigned, int> conditionCounter;
+  for (unsigned e = 1; e < edges.size(); ++e) {
+    llvm::BranchInst * br = llvm::dyn_cast<llvm::BranchInst>(blocks[edges[e].From]->getTerminator());
+    if (!br || !br->isConditional())
+      continue;
+    if (br->getSuccessor(0) == br->getSuccessor(1)) {
+      if (!conditionCounter.count(edges[e].From))
+        conditionCounter[edges[e].From] = numCounters++;
+    } else if (edges[e].To == index[br->getSuccessor(0)]) {
+      takenEdge[edges[e].From] = e;
+    }
+  }
+
+  /* the map, with tabs between the fields: keys may have spaces */
+  map << "function\t" << key << "\t" << V << "\t" << edges.size() << "\t" << numCounters << "\n";
+  for (ProfileEdge & edge : edges) {
+    map << "edge\t" << edge.From << "\t" << edge.To << "\t";
+    if (edge.Counter < 0)
+      map << "-";
+    else
+      map << edge.Counter;
+    map << (edge.Fake ? "\tfake\n" : "\n");
+  }
+  for (unsigned i = 0; i < V; ++i) {
+    std::map<unsigned, unsigned> hist;
+    for (llvm::Instruction &I : *blocks[i])
+      hist[I.getOpcode()] += 1;
+    map << "block\t" << i << "\t";
+    if (takenEdge.count(i))
+      map << "taken\t" << takenEdge[i];
+    else if (conditionCounter.count(i))
+      map << "condition\t" << conditionCounter[i];
+    else
+      map << "-";
+    for (auto & entry : hist)
+      map << "\t" << entry.first << "\t" << llvm::Instruction::getOpcodeName(entry.first) << "\t" << entry.second;
+    map << "\n";
+  }
+  if (numCounters == 0)
+    return false;
+
+  llvm::LLVMContext &C = M->getContext();
+  llvm::Type * i64 = llvm::Type::getInt64Ty(C);
+  ThreadCounters counts = createThreadCounters(*M, numCounters, "cse231.edges.counts");
+  auto increment = [&](llvm::Instruction * before, int counter, llvm::Value * n) {
+    llvm::IRBuilder<> builder(before);
+    incrementCounter(builder, counts, builder.getInt64(counter), n);
+  };
+
+  /*
+   * Where each counted edge is counted. Decided before any edge is split:
+   *   V -> entry:                   at the top of the entry
+   *   B -> V, B ending in ret:      before the ret
+   *   B -> S, S the one successor:  at the bottom of B
+   *   B -> S, B the one predecessor: at the top of S
+   *   otherwise:                    in a new block on the edge
+   */
+  std::vector<std::pair<llvm::Instruction *, int>> sites;
+  std::vector<ProfileEdge *> splits;
+  for (ProfileEdge & edge : edges) {
+    if (edge.Counter < 0)
+      continue;
+    if (edge.From == V) {
+      sites.push_back({&*blocks[0]->getFirstInsertionPt(), edge.Counter});
+      continue;
+    }
+    llvm::BasicBlock * B = blocks[edge.From];
+    if (edge.To == V) {
+      sites.push_back({B->getTerminator(), edge.Counter});
+      continue;
+    }
+    if (llvm::Instruction * site = edgeInsertionPoint(B, blocks[edge.To]))
+      sites.push_back({site, edge.Counter});
+    else
+      splits.push_back(&edge);
+  }
+  for (auto & site : sites)
+    increment(site.first, site.second, llvm::ConstantInt::get(i64, 1));
+  for (ProfileEdge * edge : splits) {
+    llvm::BasicBlock * edgeBlock = llvm::SplitCriticalEdge(blocks[edge->From], blocks[edge->To],
+                                                           llvm::CriticalEdgeSplittingOptions().setMergeIdenticalEdges());
+    increment(edgeBlock->getTerminator(), edge->Counter, llvm::ConstantInt::get(i64, 1));
+  }
+  for (auto & condition : conditionCounter) {
+    llvm::BranchInst * br = llvm::cast<llvm::BranchInst>(blocks[condition.first]->getTerminator());
+    llvm::IRBuilder<> builder(br);
+    increment(br, condition.second, builder.CreateZExt(br->getCondition(), i64));
+  }
+  registerThreadCountersOnEntry(F, counts);
+
+  /* <prefix>.dump: printOutEdgeCounts(key, counts, n) for every function */
+  llvm::FunctionCallee print = M->getOrInsertFunction("printOutEdgeCounts", llvm::Type::getVoidTy(C),
+                                                      llvm::Type::getInt8PtrTy(C), llvm::PointerType::getUnqual(i64),
+                                                      llvm::Type::getInt32Ty(C));
+  llvm::IRBuilder<> builder(exitDumpPoint(*M, prefix));
+  llvm::Value * args[] = {builder.CreateGlobalStringPtr(key),
+                          builder.CreateConstInBoundsGEP2_32(counts.Shared->getValueType(), counts.Shared, 0, 0),
+                          builder.getInt32(numCounters)};
+  builder.CreateCall(print, args);
+  return true;
+}
+
+#endif
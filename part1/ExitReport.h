@@ -0,0 +1,62 @@
+#ifndef CSE231_EXIT_REPORT_H
+#define CSE231_EXIT_REPORT_H
+
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+
+/*
+ * Print once, when the program exits, instead of before every return: a module
+ * constructor, <prefix>.ctor, hands run and print to registerExitReport of the
+ * runtime. The runtime has one report for the whole program. At exit it brings
+ * the inline counters of the running threads up to date (flushThreadCounters,
+ * see ThreadCounters.h), calls the run function of every module, and then each
+ * print function once, however many modules registered it. Either may be null.
+ *
+ * Nothing happens if the module has registered prefix already, so the passes can
+ * call this for every function they instrument. The functions are named
+ * <prefix>.*, which the passes do not instrument.
+ */
+static inline void registerExitReport(llvm::Module &M, llvm::StringRef prefix, llvm::Function * run,
+                                      llvm::FunctionCallee print = nullptr) {
+  if (M.getFunction((prefix + ".ctor").str()))
+    return;
+  llvm::LLVMContext &C = M.getContext();
+  llvm::FunctionType * voidFnTy = llvm::FunctionType::get(llvm::Type::getVoidTy(C), false);
+  llvm::PointerType * voidFnPtrTy = llvm::PointerType::getUnqual(voidFnTy);
+  auto pointer = [&](llvm::Value * fn) -> llvm::Constant * {
+    if (!fn)
+      return llvm::ConstantPointerNull::get(voidFnPtrTy);
+    return llvm::ConstantExpr::getPointerCast(llvm::cast<llvm::Constant>(fn), voidFnPtrTy);
+  };
+
+  /* void registerExitReport(void (*run)(void), void (*print)(void)) */
+  llvm::FunctionCallee registerF = M.getOrInsertFunction("registerExitReport", llvm::Type::getVoidTy(C),
+                                                         voidFnPtrTy, voidFnPtrTy);
+  llvm::Function * ctor = llvm::Function::Create(voidFnTy, llvm::GlobalValue::InternalLinkage,
+                                                 prefix + ".ctor", &M);
+  llvm::IRBuilder<> builder(llvm::BasicBlock::Create(C, "entry", ctor));
+  llvm::Value * args[] = {pointer(run), pointer(print.getCallee())};
+  builder.CreateCall(registerF, args);
+  builder.CreateRetVoid();
+  llvm::appendToGlobalCtors(M, ctor, 65535);
+}
+
+/*
+ * The end of <prefix>.dump, which the report of prefix runs at exit. The passes
+ * add there the calls that print the counters of each function they instrument.
+ */
+static inline llvm::Instruction * exitDumpPoint(llvm::Module &M, llvm::StringRef prefix) {
+  llvm::Function * dump = M.getFunction((prefix + ".dump").str());
+  if (!dump) {
+    llvm::LLVMContext &C = M.getContext();
+    dump = llvm::Function::Create(llvm::FunctionType::get(llvm::Type::getVoidTy(C), false),
+                                  llvm::GlobalValue::InternalLinkage, prefix + ".dump", &M);
+    llvm::ReturnInst::Create(C, llvm::BasicBlock::Create(C, "entry", dump));
+    registerExitReport(M, prefix, dump);
+  }
+  return dump->getEntryBlock().getTerminator();
+}
+
+#endif
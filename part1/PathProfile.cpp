@@ -0,0 +1,303 @@
+#include "llvm/Pass.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+#include "ExitReport.h"
+#include "EdgeProfile.h"
+#include "ThreadCounters.h"
+#include <memory>
+#include <set>
+
+using namespace llvm;
+using namespace std;
+
+static cl::opt<std::string> PathMap("paths-map", cl::init("paths.map"), cl::value_desc("map file"),
+    cl::desc("Describe the path numbering of each function in this file, for decode_paths.py"));
+
+static cl::opt<unsigned> PathArrayLimit("paths-array-limit", cl::init(4096),
+    cl::desc("Number of paths above which a function counts its paths in a hash table of the runtime"));
+
+namespace {
+
+/*
+ * Ball-Larus path profiling. The back edges of a DFS of the CFG are cut, so what
+ * is left is a DAG, from the entry to a virtual exit node X. A back edge B -> H
+ * becomes the two edges entry -> H and B -> X, and a block that leaves the
+ * function gets the edge B -> X. Going over the DAG from X back to the entry,
+ * every edge gets a value such that the sums of the values along the paths from
+ * the entry to X number them from 0 to NumPaths(entry) - 1.
+ *
+ * A path register r starts at 0 and adds the value of every edge taken. On a back
+ * edge the path r + Val(B -> X) is counted and r starts over at Val(entry -> H);
+ * on leaving the function r + Val(B -> X) is counted. The counts are in an array
+ * of the function if it has at most -paths-array-limit paths, which each thread
+ * counts into a copy of (ThreadCounters.h), and otherwise in the hash tables of
+ * the runtime, under an id of the function: the FNV-1a hash of its key. Either
+ * way they are printed at exit; the map file and decode_paths.py turn the path
+ * ids back into blocks.
+ */
+struct PathProfile : public FunctionPass {
+  static char ID;
+  // The path map of -paths-map
+  std::unique_ptr<raw_fd_ostream> Map;
+
+  enum EdgeKind { Real, Start, End, Exit };
+
+  struct PathEdge {
+    unsigned From, To;  // block indices; X is the number of blocks
+    EdgeKind Kind;
+    uint64_t Val;
+  };
+
+  PathProfile() : FunctionPass(ID) {}
+
+  bool doInitialization(Module &) override {
+    std::error_code EC;
+    Map.reset(new raw_fd_ostream(PathMap, EC, sys::fs::OF_Text));
+    if (EC) {
+      errs() << "error: cannot open " << PathMap << ": " << EC.message() << "\n";
+      Map.reset();
+      return false;
+    }
+    *Map << "profile\tcse231-paths\n";
+    return false;
+  }
+
+  bool doFinalization(Module &) override {
+    Map.reset();
+    return false;
+  }
+
+  bool runOnFunction(Function &F) override {
+    if (!Map || F.getName().startswith("cse231.paths."))
+      return false;
+    Module *M = F.getParent();
+    std::string key = M->getModuleIdentifier() + ":" + F.getName().str();
+    for (BasicBlock &B : F) {
+      unsigned opcode = B.getTerminator()->getOpcode();
+      if (opcode != Instruction::Br && opcode != Instruction::Switch &&
+          opcode != Instruction::Ret && opcode != Instruction::Unreachable) {
+        *Map << "unprofiled\t" << key << "\n";
+        return false;
+      }
+    }
+
+    std::vector<BasicBlock *> blocks;
+    DenseMap<BasicBlock *, unsigned> index;
+    for (BasicBlock &B : F) {
+      index[&B] = blocks.size();
+      blocks.push_back(&B);
+    }
+    unsigned X = blocks.size();
+
+    /* the successors of each block, with duplicates merged */
+    std::vector<SmallVector<unsigned, 4>> succs(X);
+    for (unsigned i = 0; i < X; ++i)
+      for (BasicBlock * S : successors(blocks[i]))
+        if (std::find(succs[i].begin(), succs[i].end(), index[S]) == succs[i].end())
+          succs[i].push_back(index[S]);
+
+    /* DFS from the entry: the back edges, and a postorder of the blocks it reaches */
+    std::vector<unsigned char> state(X, 0); // 0 not seen, 1 on the DFS stack, 2 done
+    std::vector<std::pair<unsigned, unsigned>> backEdges;
+    std::set<std::pair<unsigned, unsigned>> isBackEdge;
+    std::vector<unsigned> postorder;
+    std::vector<std::pair<unsigned, unsigned>> stack; // block, next successor
+    stack.push_back({0, 0});
+    state[0] = 1;
+    while (!stack.empty()) {
+      unsigned b = stack.back().first;
+      if (stack.back().second == succs[b].size()) {
+        state[b] = 2;
+        postorder.push_back(b);
+        stack.pop_back();
+        continue;
+      }
+      unsigned s = succs[b][stack.back().second++];
+      if (state[s] == 1) {
+        backEdges.push_back({b, s});
+        isBackEdge.insert({b, s});
+      } else if (state[s] == 0) {
+        state[s] = 1;
+        stack.push_back({s, 0});
+      }
+    }
+
+    /* the DAG edges out of each block: its successors or the exit, then its back edges */
+    std::vector<PathEdge> edges;
+    std::vector<std::vector<unsigned>> out(X);
+    std::map<unsigned, unsigned> startEdge;              // header -> entry -> H
+    std::map<std::pair<unsigned, unsigned>, unsigned> endEdge; // back edge -> B -> X
+    for (unsigned b : postorder) {
+      for (unsigned s : succs[b]) {
+        if (isBackEdge.count({b, s}))
+          continue;
+        out[b].push_back(edges.size());
+        edges.push_back({b, s, Real, 0});
+      }
+      if (succs[b].empty()) {
+        out[b].push_back(edges.size());
+        edges.push_back({b, X, Exit, 0});
+      }
+    }
+    for (auto & back : backEdges) {
+      endEdge[back] = edges.size();
+      out[back.first].push_back(edges.size());
+      edges.push_back({back.first, X, End, 0});
+      if (!startEdge.count(back.second)) {
+        startEdge[back.second] = edges.size();
+        out[0].push_back(edges.size());
+        edges.push_back({0, back.second, Start, 0});
+      }
+    }
+
+    /* the values, from X back to the entry; the postorder has the entry last */
+    std::vector<uint64_t> numPaths(X + 1, 0);
+    numPaths[X] = 1;
+    for (unsigned b : postorder) {
+      uint64_t n = 0;
+      for (unsigned e : out[b]) {
+        edges[e].Val = n;
+        if (numPaths[edges[e].To] > UINT64_MAX - n) {
+          *Map << "unprofiled\t" << key << "\n";
+          return false;
+        }
+        n += numPaths[edges[e].To];
+      }
+      numPaths[b] = n;
+    }
+    uint64_t total = numPaths[0];
+    bool hashed = total > PathArrayLimit;
+
+    /* the map, with tabs between the fields: keys and block names may have spaces */
+    *Map << "function\t" << key << "\t" << X << "\t" << total << "\t" << (hashed ? "hash" : "array") << "\n";
+    for (unsigned i = 0; i < X; ++i)
+      *Map << "block\t" << i << "\t" << (blocks[i]->hasName() ? blocks[i]->getName() : "-") << "\n";
+    static const char * const kinds[] = {"real", "start", "end", "exit"};
+    for (unsigned b : postorder)
+      for (unsigned e : out[b])
+        *Map << "edge\t" << edges[e].From << "\t" << edges[e].To << "\t" << edges[e].Val << "\t"
+             << kinds[edges[e].Kind] << "\n";
+    if (total == 0)
+      return false;
+
+    /*
+     * The code of each edge: r += Val on a DAG edge with a value, the count and
+     * the restart on a back edge. The places are all decided before an edge is
+     * split or code is added; the code of the exits goes after that of the edges.
+     */
+    Instruction * entryTop = &*blocks[0]->getFirstInsertionPt();
+    struct EdgeCode {
+      unsigned From, To;
+      int Edge;      // the DAG edge, for r += Val
+      int Back;      // the back edge, as its edge to X
+    };
+    std::vector<std::pair<Instruction *, EdgeCode>> sites;
+    std::vector<EdgeCode> splits;
+    auto place = [&](const EdgeCode & code) {
+      if (Instruction * site = edgeInsertionPoint(blocks[code.From], blocks[code.To]))
+        sites.push_back({site, code});
+      else
+        splits.push_back(code);
+    };
+    for (unsigned e = 0; e < edges.size(); ++e)
+      if (edges[e].Kind == Real && edges[e].Val != 0)
+        place({edges[e].From, edges[e].To, (int)e, -1});
+    for (auto & back : backEdges)
+      place({back.first, back.second, -1, (int)endEdge[back]});
+    std::vector<std::pair<Instruction *, uint64_t>> exits;
+    for (PathEdge & edge : edges) {
+      if (edge.Kind != Exit)
+        continue;
+      BasicBlock * B = blocks[edge.From];
+      // Before the call of a noreturn function, if the block ends in unreachable
+      Instruction * site = isa<ReturnInst>(B->getTerminator()) ? B->getTerminator() : &*B->getFirstInsertionPt();
+      exits.push_back({site, edge.Val});
+    }
+
+    LLVMContext &C = M->getContext();
+    Type * i64 = Type::getInt64Ty(C);
+    // r = 0 goes first, before the code of the edges placed at the top of the entry
+    IRBuilder<> builder(entryTop);
+    AllocaInst * r = builder.CreateAlloca(i64, nullptr, "cse231.path");
+    builder.CreateStore(builder.getInt64(0), r);
+
+    ThreadCounters counts = {};
+    FunctionCallee update;
+    uint64_t id = 14695981039346656037ULL;
+    if (hashed) {
+      for (char c : key)
+        id = (id ^ (unsigned char)c) * 1099511628211ULL;
+      if (id == 0)
+        id = 1; // the runtime's free slots
+      update = M->getOrInsertFunction("updatePathCount", Type::getVoidTy(C), i64, i64);
+    } else {
+      counts = createThreadCounters(*M, total, "cse231.paths.counts");
+    }
+
+    /* count the path r + val */
+    auto countPath = [&](Instruction * before, uint64_t val) {
+      IRBuilder<> builder(before);
+      Value * path = builder.CreateAdd(builder.CreateLoad(i64, r), builder.getInt64(val));
+      if (hashed) {
+        Value * args[] = {builder.getInt64(id), path};
+        builder.CreateCall(update, args);
+      } else {
+        incrementCounter(builder, counts, path, builder.getInt64(1));
+      }
+    };
+    /* r += val, or r = val */
+    auto setPath = [&](Instruction * before, uint64_t val, bool add) {
+      IRBuilder<> builder(before);
+      Value * v = builder.getInt64(val);
+      builder.CreateStore(add ? builder.CreateAdd(builder.CreateLoad(i64, r), v) : v, r);
+    };
+
+    auto emit = [&](Instruction * before, const EdgeCode & code) {
+      if (code.Edge >= 0) {
+        setPath(before, edges[code.Edge].Val, true);
+      } else {
+        countPath(before, edges[code.Back].Val);
+        setPath(before, edges[startEdge[code.To]].Val, false);
+      }
+    };
+    for (auto & site : sites)
+      emit(site.first, site.second);
+    for (EdgeCode & code : splits) {
+      BasicBlock * edgeBlock = SplitCriticalEdge(blocks[code.From], blocks[code.To],
+                                                 CriticalEdgeSplittingOptions().setMergeIdenticalEdges());
+      emit(edgeBlock->getTerminator(), code);
+    }
+    for (auto & exit : exits)
+      countPath(exit.first, exit.second);
+    if (!hashed)
+      registerThreadCountersOnEntry(F, counts);
+
+    /* print the counts at exit */
+    IRBuilder<> dump(exitDumpPoint(*M, "cse231.paths"));
+    Value * name = dump.CreateGlobalStringPtr(key);
+    if (hashed) {
+      FunctionCallee print = M->getOrInsertFunction("printOutPathTable", Type::getVoidTy(C),
+                                                    Type::getInt8PtrTy(C), i64);
+      Value * args[] = {name, dump.getInt64(id)};
+      dump.CreateCall(print, args);
+    } else {
+      FunctionCallee print = M->getOrInsertFunction("printOutPathCounts", Type::getVoidTy(C),
+                                                    Type::getInt8PtrTy(C), PointerType::getUnqual(i64),
+                                                    Type::getInt32Ty(C));
+      Value * args[] = {name, dump.CreateConstInBoundsGEP2_32(counts.Shared->getValueType(), counts.Shared, 0, 0),
+                        dump.getInt32(total)};
+      dump.CreateCall(print, args);
+    }
+    return true;
+  }
+}; // end of struct PathProfile
+}  // end of anonymous namespace
+
+char PathProfile::ID = 0;
+static RegisterPass<PathProfile> X("cse231-paths", "Ball-Larus path profiling",
+                             false /* Only looks at CFG */,
+                             false /* Analysis Pass */);
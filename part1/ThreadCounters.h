@@ -0,0 +1,92 @@
+#ifndef CSE231_THREAD_COUNTERS_H
+#define CSE231_THREAD_COUNTERS_H
+
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+
+/*
+ * Counters that the threads of the program update without sharing them. The
+ * instrumented code counts into a thread-local copy of an array, with plain
+ * loads and stores. The first time a function runs in a thread, it hands its
+ * copy to registerThreadCounters, and the runtime adds the copy into the shared
+ * array when the thread exits and when an exit report starts
+ * (flushThreadCounters). The exit report prints the shared array.
+ *
+ * The copy has one more element than the array, set by the runtime once the
+ * thread has registered it. The copies use the initial-exec TLS model, so the
+ * instrumented code must be in the executable or in a library loaded at startup.
+ */
+struct ThreadCounters {
+  llvm::GlobalVariable * Shared; // [N x i64]
+  llvm::GlobalVariable * Local;  // thread_local [N + 1 x i64]
+  unsigned N;
+};
+
+static inline ThreadCounters createThreadCounters(llvm::Module &M, unsigned n, const llvm::Twine &name) {
+  llvm::Type * i64 = llvm::Type::getInt64Ty(M.getContext());
+  llvm::ArrayType * sharedTy = llvm::ArrayType::get(i64, n);
+  llvm::ArrayType * localTy = llvm::ArrayType::get(i64, n + 1);
+  llvm::GlobalVariable * shared = new llvm::GlobalVariable(M, sharedTy, false, llvm::GlobalValue::InternalLinkage,
+                                                           llvm::ConstantAggregateZero::get(sharedTy), name);
+  llvm::GlobalVariable * local = new llvm::GlobalVariable(M, localTy, false, llvm::GlobalValue::InternalLinkage,
+                                                          llvm::ConstantAggregateZero::get(localTy), name + ".local",
+                                                          nullptr, llvm::GlobalValue::InitialExecTLSModel);
+  return {shared, local, n};
+}
+
+/* The thread-local counter i, counter[0] being the first */
+static inline llvm::Value * localCounter(llvm::IRBuilder<> &builder, const ThreadCounters &counters,
+                                         llvm::Value * i) {
+  return builder.CreateInBoundsGEP(counters.Local->getValueType(), counters.Local, {builder.getInt64(0), i});
+}
+
+/* counter i += n in the thread-local copy */
+static inline void incrementCounter(llvm::IRBuilder<> &builder, const ThreadCounters &counters,
+                                    llvm::Value * i, llvm::Value * n) {
+  llvm::Value * slot = localCounter(builder, counters, i);
+  llvm::Type * i64 = builder.getInt64Ty();
+  builder.CreateStore(builder.CreateAdd(builder.CreateLoad(i64, slot), n), slot);
+}
+
+/*
+ * Make F register the copy of counters of its thread when it starts, unless that
+ * thread already has. Call it last: it splits the entry block, after its allocas.
+ */
+static inline void registerThreadCountersOnEntry(llvm::Function &F, const ThreadCounters &counters) {
+  llvm::Module *M = F.getParent();
+  llvm::LLVMContext &C = M->getContext();
+  llvm::Type * i64 = llvm::Type::getInt64Ty(C);
+  llvm::BasicBlock &entry = F.getEntryBlock();
+
+  // The static allocas stay in the entry block, before the split
+  llvm::Instruction * top = &*entry.getFirstInsertionPt();
+  while (llvm::isa<llvm::AllocaInst>(top) && llvm::cast<llvm::AllocaInst>(top)->isStaticAlloca())
+    top = top->getNextNode();
+  for (llvm::Instruction * I = top; I; ) {
+    llvm::Instruction * next = I->getNextNode();
+    if (llvm::AllocaInst * alloca = llvm::dyn_cast<llvm::AllocaInst>(I))
+      if (alloca->isStaticAlloca())
+        alloca->moveBefore(top);
+    I = next;
+  }
+
+  llvm::FunctionCallee reg = M->getOrInsertFunction("registerThreadCounters", llvm::Type::getVoidTy(C),
+                                                    llvm::PointerType::getUnqual(i64),
+                                                    llvm::PointerType::getUnqual(i64),
+                                                    llvm::Type::getInt32Ty(C));
+  llvm::IRBuilder<> builder(top);
+  llvm::Value * registered = builder.CreateLoad(i64, localCounter(builder, counters, builder.getInt64(counters.N)));
+  llvm::Instruction * then = llvm::SplitBlockAndInsertIfThen(builder.CreateICmpEQ(registered, builder.getInt64(0)),
+                                                             top, false,
+                                                             llvm::MDBuilder(C).createBranchWeights(1, 1 << 20));
+  builder.SetInsertPoint(then);
+  llvm::Value * args[] = {localCounter(builder, counters, builder.getInt64(0)),
+                          builder.CreateConstInBoundsGEP2_32(counters.Shared->getValueType(), counters.Shared, 0, 0),
+                          builder.getInt32(counters.N)};
+  builder.CreateCall(reg, args);
+}
+
+#endif
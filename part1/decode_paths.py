@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+"""Turn the path ids of cse231-paths back into blocks.
+
+A module instrumented with -cse231-paths -paths-map=<map> prints the count of
+every Ball-Larus path it took when it exits. This script reads the maps and
+the program's stderr and prints the paths, hottest first:
+
+    opt -load CSE231.so -cse231-paths -paths-map=prog.map prog.ll -o inst.bc
+    ./prog 2> counts.txt
+    decode_paths.py prog.map --counts counts.txt [--top 20]
+
+Each line is "<count>\\t<module>:<function>\\t<path id>\\t<blocks>". A path
+starts at the entry, or at a loop header if it follows a back edge, and ends
+at a return, or at a back edge, shown as "(back edge)". Unnamed blocks are
+shown as %<index> in the order of the function.
+"""
+
+import argparse
+import collections
+import sys
+
+
+class Function:
+    def __init__(self, key, num_paths):
+        self.key = key
+        self.num_paths = num_paths
+        self.names = []
+        self.out = collections.defaultdict(list)  # block -> [(val, to, kind)]
+
+    def decode(self, path):
+        """The blocks of a path, and whether it ends at a back edge"""
+        node = 0
+        blocks = [0]
+        while True:
+            # The values of the edges out of a block increase: take the last one
+            # that the rest of the id covers
+            val, to, kind = [e for e in self.out[node] if e[0] <= path][-1]
+            path -= val
+            if kind == 'start':
+                blocks = [to]
+            elif kind == 'real':
+                blocks.append(to)
+            else:
+                return blocks, kind == 'end'
+            node = to
+
+    def name(self, block):
+        name = self.names[block]
+        return name if name != '-' else '%%%d' % block
+
+
+def read_map(path, functions):
+    function = None
+    with open(path) as f:
+        for line in f:
+            # Tabs separate the fields: module and block names may have spaces
+            words = line.rstrip('\n').split('\t')
+            if words == ['']:
+                continue
+            if words[0] == 'unprofiled':
+                print('warning: %s was not instrumented' % words[1], file=sys.stderr)
+            elif words[0] == 'function':
+                function = Function(words[1], int(words[3]))
+                functions[function.key] = function
+            elif words[0] == 'block':
+                function.names.append(words[2])
+            elif words[0] == 'edge':
+                src, dst, val, kind = int(words[1]), int(words[2]), int(words[3]), words[4]
+                function.out[src].append((val, dst, kind))
+
+
+def read_counts(f):
+    counts = collections.Counter()
+    for line in f:
+        if not line.startswith('paths\t'):
+            continue
+        _, key, values = line.rstrip('\n').split('\t')
+        for value in values.split():
+            path, count = value.split(':')
+            counts[(key, int(path))] += int(count)
+    return counts
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('maps', nargs='+', help='map files written by cse231-paths')
+    parser.add_argument('--counts', type=argparse.FileType('r'), default=sys.stdin,
+                        help='stderr of the instrumented program (default: stdin)')
+    parser.add_argument('--top', type=int, help='only print the hottest paths')
+    args = parser.parse_args()
+
+    functions = {}
+    for path in args.maps:
+        read_map(path, functions)
+    for function in functions.values():
+        for edges in function.out.values():
+            edges.sort(key=lambda e: e[0])
+
+    counts = read_counts(args.counts)
+    hottest = sorted(counts.items(), key=lambda item: (-item[1], item[0]))
+    for (key, path), count in hottest[:args.top]:
+        function = functions.get(key)
+        if function is None:
+            print('warning: no map of %s' % key, file=sys.stderr)
+            continue
+        blocks, back = function.decode(path)
+        text = ' -> '.join(function.name(b) for b in blocks)
+        if back:
+            text += ' (back edge)'
+        print('%d\t%s\t%d\t%s' % (count, key, path, text))
+
+
+if __name__ == '__main__':
+    main()
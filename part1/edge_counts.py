@@ -0,0 +1,196 @@
+#!/usr/bin/env python3
+"""Derive the block and edge counts of an edge profile.
+
+A module instrumented with -bb-edge-profile=<map> or -cdi-edge-profile=<map>
+only counts the edges off a spanning tree of each CFG, and prints those
+counters when it exits. This script reads the maps and the program's stderr,
+derives the counts of the tree edges from flow conservation, and prints what
+the pass prints without the option: the branch totals for cse231-bb, the
+opcode totals for cse231-cdi.
+
+    opt -load CSE231.so -cse231-bb -bb-edge-profile=prog.map prog.ll -o inst.bc
+    ./prog 2> counts.txt
+    edge_counts.py prog.map --counts counts.txt [--blocks] [--edges]
+
+--blocks and --edges also print the count of every block and edge, as
+"<module>:<function>\\t<block>\\t<count>" and
+"<module>:<function>\\t<from>\\t<to>\\t<count>". Block V, the number of
+blocks, stands for the callers of the function. A block counts the runs that
+reached its terminator, not those that a call in it did not return from (exit,
+abort, longjmp); those are in the count of its edge to V.
+
+The derived counts must be non-negative and conserve the flow at every block.
+If they do not, the maps and the counts are not of the same program, and the
+script fails.
+"""
+
+import argparse
+import collections
+import sys
+
+
+class Function:
+    def __init__(self, key, num_blocks, num_counters):
+        self.key = key
+        self.num_blocks = num_blocks
+        self.num_counters = num_counters
+        self.edges = []      # [from, to, counter or None, fake]
+        self.branches = {}   # block -> ('taken', edge) or ('condition', counter)
+        self.histograms = {} # block -> [(opcode, name, count)]
+
+
+def read_map(path, functions, passes):
+    function = None
+    with open(path) as f:
+        for line in f:
+            # Tabs separate the fields: module and block names may have spaces
+            words = line.rstrip('\n').split('\t')
+            if words == ['']:
+                continue
+            if words[0] == 'profile':
+                passes.add(words[1])
+            elif words[0] == 'unprofiled':
+                print('warning: %s was not instrumented' % words[1], file=sys.stderr)
+            elif words[0] == 'function':
+                function = Function(words[1], int(words[2]), int(words[4]))
+                functions[function.key] = function
+            elif words[0] == 'edge':
+                counter = None if words[3] == '-' else int(words[3])
+                function.edges.append([int(words[1]), int(words[2]), counter, words[4:] == ['fake']])
+            elif words[0] == 'block':
+                block = int(words[1])
+                rest = words[2:]
+                if rest[0] == '-':
+                    rest = rest[1:]
+                else:
+                    function.branches[block] = (rest[0], int(rest[1]))
+                    rest = rest[2:]
+                function.histograms[block] = [(int(rest[i]), rest[i + 1], int(rest[i + 2]))
+                                              for i in range(0, len(rest), 3)]
+
+
+def read_counts(f):
+    counts = {}
+    for line in f:
+        if not line.startswith('edges\t'):
+            continue
+        _, key, values = line.rstrip('\n').split('\t')
+        values = [int(v) for v in values.split()]
+        if key in counts:
+            values = [a + b for a, b in zip(counts[key], values)]
+        counts[key] = values
+    return counts
+
+
+def solve(function, counters):
+    """Edge counts, from the counted edges and flow conservation at every node"""
+    edge_counts = [counters[e[2]] if e[2] is not None else None for e in function.edges]
+    incident = collections.defaultdict(list)
+    for i, (src, dst, _, _) in enumerate(function.edges):
+        if src != dst:
+            incident[src].append(i)
+            incident[dst].append(i)
+
+    def unknown(node):
+        return [i for i in incident[node] if edge_counts[i] is None]
+
+    # Peel the leaves of the tree: a node with one unknown edge fixes it
+    pending = [n for n in incident if len(unknown(n)) == 1]
+    while pending:
+        node = pending.pop()
+        left = unknown(node)
+        if len(left) != 1:
+            continue
+        flow = 0
+        for i in incident[node]:
+            if i != left[0]:
+                flow += edge_counts[i] if function.edges[i][1] == node else -edge_counts[i]
+        src, dst, _, _ = function.edges[left[0]]
+        edge_counts[left[0]] = flow if src == node else -flow
+        for other in (src, dst):
+            if len(unknown(other)) == 1:
+                pending.append(other)
+    return edge_counts
+
+
+def check(function, edge_counts):
+    """Why the solved counts cannot be right, or None"""
+    flow = [0] * (function.num_blocks + 1)
+    for (src, dst, _, _), count in zip(function.edges, edge_counts):
+        if count is None:
+            return 'edge %d -> %d has no count' % (src, dst)
+        if count < 0:
+            return 'edge %d -> %d has count %d' % (src, dst, count)
+        flow[src] -= count
+        flow[dst] += count
+    for block, balance in enumerate(flow):
+        if balance:
+            return 'block %d is entered %+d more times than it is left' % (block, balance)
+    return None
+
+
+def block_counts(function, edge_counts):
+    """How many times each block reached its terminator: the counts of its real out edges"""
+    counts = [0] * (function.num_blocks + 1)
+    for (src, _, _, fake), count in zip(function.edges, edge_counts):
+        if not fake:
+            counts[src] += count
+    return counts
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('maps', nargs='+', help='map files written by the passes')
+    parser.add_argument('--counts', type=argparse.FileType('r'), default=sys.stdin,
+                        help='stderr of the instrumented program (default: stdin)')
+    parser.add_argument('--blocks', action='store_true', help='print the count of every block')
+    parser.add_argument('--edges', action='store_true', help='print the count of every edge')
+    args = parser.parse_args()
+
+    functions = {}
+    passes = set()
+    for path in args.maps:
+        read_map(path, functions, passes)
+    counts = read_counts(args.counts)
+
+    taken = total = 0
+    opcodes = collections.Counter()
+    names = {}
+    for key, function in functions.items():
+        counters = counts.get(key, [0] * function.num_counters)
+        edge_counts = solve(function, counters)
+        error = check(function, edge_counts)
+        if error:
+            sys.exit('error: %s: %s' % (key, error))
+        runs = block_counts(function, edge_counts)
+
+        for block, (kind, n) in function.branches.items():
+            taken += edge_counts[n] if kind == 'taken' else counters[n]
+            total += runs[block]
+        for block, histogram in function.histograms.items():
+            for opcode, name, n in histogram:
+                opcodes[opcode] += runs[block] * n
+                names[opcode] = name
+
+        if args.blocks:
+            for block, count in enumerate(runs):
+                print('%s\t%d\t%d' % (key, block, count))
+        if args.edges:
+            # The fake edge of a block goes with its edge to V, if it has one
+            merged = collections.OrderedDict()
+            for (src, dst, _, _), count in zip(function.edges, edge_counts):
+                merged[(src, dst)] = merged.get((src, dst), 0) + count
+            for (src, dst), count in merged.items():
+                print('%s\t%d\t%d\t%d' % (key, src, dst, count))
+
+    if 'cse231-cdi' in passes:
+        for opcode in sorted(opcodes):
+            if opcodes[opcode]:
+                print('%s\t%d' % (names[opcode], opcodes[opcode]))
+    if 'cse231-bb' in passes:
+        print('taken\t%d' % taken)
+        print('total\t%d' % total)
+
+
+if __name__ == '__main__':
+    main()
@@ -14,14 +14,37 @@
 #ifndef LLVM_TRANSFORMS_231DFA_H
 #define LLVM_TRANSFORMS_231DFA_H
 
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
 #include "llvm/InitializePasses.h"
 #include "llvm/IR/CFG.h"
 #include "llvm/IR/InstIterator.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MathExtras.h"
 #include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <deque>
+#include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -36,15 +59,16 @@ class Info {
   public:
     Info() {}
     Info(const Info& other) {}
+    Info & operator=(const Info &) = default;
     virtual ~Info() {};
 
     /*
-     * Print out the information
+     * Print out the information to OS
      *
      * Direction:
      *   In your subclass you should implement this function according to the project specifications.
      */
-    virtual void print() = 0;
+    virtual void print(raw_ostream & OS) = 0;
 
     /*
      * Compare two pieces of information
@@ -61,29 +85,515 @@ class Info {
      *   In your subclass you need to implement this function.
      */
     static Info* join(Info * info1, Info * info2, Info * result);
+
+    /*
+     * Optionally, a subclass may also provide an in-place join:
+     *
+     *   static bool joinInto(SubInfo * dst, SubInfo * src);
+     *
+     * It joins src into dst and returns true if dst changed. When it is available
+     * the worklist algorithm updates edges with it instead of join followed by equals,
+     * which saves a temporary Info and a second traversal per outgoing edge.
+     * It is deliberately not declared here so that HasJoinInto can detect it.
+     */
+
+    /*
+     * Interning (DataFlowAnalysis::setInterning) also needs a hash of the value:
+     *
+     *   size_t hash() const;
+     *
+     * Informations that are equal must have the same hash.
+     */
+
+    /*
+     * Incremental re-analysis (DataFlowAnalysis::rerunWorklistAlgorithm) after an
+     * edit that added or removed instructions also needs
+     *
+     *   void remap(const std::vector<unsigned> & NewIndex);
+     *
+     * which renames every instruction index i held by the information to NewIndex[i],
+     * and drops it if NewIndex[i] is ~0u (the instruction was removed).
+     */
+
+    /*
+     * An information that keeps its value on the heap may tell how large it is:
+     *
+     *   size_t payloadBytes() const;
+     *
+     * The peak size of the arena (getPeakArenaSize) then counts it too. Like
+     * joinInto it is detected, by HasPayloadBytes.
+     */
+};
+
+/*
+ * HasJoinInto<T>::value is true if T provides static bool joinInto(T *, T *).
+ */
+template <class T>
+class HasJoinInto {
+  template <class U>
+  static auto check(U *) -> decltype(U::joinInto((U *)nullptr, (U *)nullptr), std::true_type());
+  template <class U>
+  static std::false_type check(...);
+
+  public:
+    static const bool value = decltype(check<T>(nullptr))::value;
+};
+
+/*
+ * HasRemap<T>::value is true if T provides void remap(const std::vector<unsigned> &).
+ */
+template <class T>
+class HasRemap {
+  template <class U>
+  static auto check(U * u) -> decltype(u->remap(std::vector<unsigned>()), std::true_type());
+  template <class U>
+  static std::false_type check(...);
+
+  public:
+    static const bool value = decltype(check<T>(nullptr))::value;
+};
+
+/*
+ * HasPayloadBytes<T>::value is true if T provides size_t payloadBytes() const.
+ */
+template <class T>
+class HasPayloadBytes {
+  template <class U>
+  static auto check(const U * u) -> decltype(size_t(u->payloadBytes()), std::true_type());
+  template <class U>
+  static std::false_type check(...);
+
+  public:
+    static const bool value = decltype(check<T>(nullptr))::value;
+};
+
+/*
+ * A set of instruction indices stored as a dense bit vector.
+ * Bit i is set when the instruction with index i (as assigned by assignIndiceToInstrs)
+ * is in the set. Join and equals work on whole 64-bit words, so they cost
+ * O(#instructions / 64) regardless of how many elements the sets hold.
+ * Analyses whose information is a set of instructions can subclass it directly.
+ */
+class BitVectorInfo : public Info {
+  public:
+    BitVectorInfo() {}
+
+    std::vector<uint64_t> Words;
+
+    void insert(unsigned index) {
+      unsigned word = index / 64;
+      if (word >= Words.size())
+        Words.resize(word + 1, 0);
+      Words[word] |= uint64_t(1) << (index % 64);
+    }
+
+    void erase(unsigned index) {
+      unsigned word = index / 64;
+      if (word < Words.size())
+        Words[word] &= ~(uint64_t(1) << (index % 64));
+    }
+
+    bool contains(unsigned index) const {
+      unsigned word = index / 64;
+      return word < Words.size() && (Words[word] >> (index % 64)) & 1;
+    }
+
+    /* Call fn on each index in the set, in increasing order */
+    template <typename Fn>
+    void forEach(Fn fn) const {
+      for (unsigned w = 0; w < Words.size(); ++w) {
+        uint64_t bits = Words[w];
+        while (bits) {
+          fn(w * 64 + countTrailingZeros(bits));
+          bits &= bits - 1;
+        }
+      }
+    }
+
+    /* Print out the information */
+    void print(raw_ostream & OS) {
+      forEach([&OS](unsigned index) { OS << index << "|"; });
+      OS << "\n";
+    }
+
+    /* Rename each index i to newIndex[i], dropping those mapped to ~0u */
+    void remap(const std::vector<unsigned> & newIndex) {
+      BitVectorInfo renamed;
+      forEach([&](unsigned index) {
+        if (newIndex[index] != ~0u)
+          renamed.insert(newIndex[index]);
+      });
+      Words.swap(renamed.Words);
+    }
+
+    /* Hash of the set. Trailing zero words are ignored, as in equals. */
+    size_t hash() const {
+      unsigned size = Words.size();
+      while (size > 0 && Words[size - 1] == 0)
+        --size;
+      return hash_combine_range(Words.begin(), Words.begin() + size);
+    }
+
+    /* Bytes of the words, on the heap */
+    size_t payloadBytes() const {
+      return Words.capacity() * sizeof(uint64_t);
+    }
+
+    /* Compare two pieces of information. Missing trailing words are zero. */
+    static bool equals(BitVectorInfo * info1, BitVectorInfo * info2) {
+      const std::vector<uint64_t> & shorter = info1->Words.size() < info2->Words.size() ? info1->Words : info2->Words;
+      const std::vector<uint64_t> & longer = info1->Words.size() < info2->Words.size() ? info2->Words : info1->Words;
+
+      if (!std::equal(shorter.begin(), shorter.end(), longer.begin()))
+        return false;
+      for (unsigned w = shorter.size(); w < longer.size(); ++w)
+        if (longer[w])
+          return false;
+      return true;
+    }
+
+    /*
+     * Join two pieces of information.
+     * The third parameter points to the result and may alias either input.
+     */
+    static BitVectorInfo * join(BitVectorInfo * info1, BitVectorInfo * info2, BitVectorInfo * result) {
+      joinInto(result, info1);
+      joinInto(result, info2);
+      return result;
+    }
+
+    /*
+     * Gen/kill transfer function: result = gen U (in - kill).
+     * result may alias in.
+     */
+    static void transfer(BitVectorInfo * result, BitVectorInfo * in, BitVectorInfo * gen, BitVectorInfo * kill) {
+      std::vector<uint64_t> words(std::max(in->Words.size(), gen->Words.size()), 0);
+
+      for (unsigned w = 0, e = in->Words.size(); w < e; ++w)
+        words[w] = in->Words[w] & ~(w < kill->Words.size() ? kill->Words[w] : 0);
+      for (unsigned w = 0, e = gen->Words.size(); w < e; ++w)
+        words[w] |= gen->Words[w];
+      result->Words.swap(words);
+    }
+
+    /* Join src into dst. Return true if dst changed. */
+    static bool joinInto(BitVectorInfo * dst, BitVectorInfo * src) {
+      if (dst->Words.size() < src->Words.size())
+        dst->Words.resize(src->Words.size(), 0);
+
+      uint64_t * d = dst->Words.data();
+      const uint64_t * s = src->Words.data();
+      uint64_t changed = 0;
+      for (unsigned w = 0, e = src->Words.size(); w < e; ++w) {
+        uint64_t old = d[w];
+        d[w] = old | s[w];
+        changed |= d[w] ^ old;
+      }
+      return changed != 0;
+    }
+};
+
+/*
+ * A per-analysis pool that owns every Info object created while a function is analyzed.
+ * Objects are never freed one by one; all of them are destroyed in one shot when
+ * the arena is reset or goes away together with its analysis.
+ */
+template <class Info>
+class InfoArena {
+  private:
+    SpecificBumpPtrAllocator<Info> Allocator;
+    // Released objects, handed out again by create()
+    std::vector<Info *> FreeList;
+    size_t NumInfos;
+    size_t PeakInfos;
+
+  public:
+    InfoArena() : NumInfos(0), PeakInfos(0) {}
+
+    /* Allocate a default-constructed Info owned by the arena */
+    Info * create() {
+      ++NumInfos;
+      if (NumInfos > PeakInfos)
+        PeakInfos = NumInfos;
+      if (!FreeList.empty()) {
+        Info * info = FreeList.back();
+        FreeList.pop_back();
+        *info = Info();
+        return info;
+      }
+      return new (Allocator.Allocate()) Info();
+    }
+
+    /* Give back an Info that is no longer referenced, so that create() can reuse it */
+    void release(Info * info) {
+      --NumInfos;
+      FreeList.push_back(info);
+    }
+
+    /* Destroy all the Info objects of the arena */
+    void reset() {
+      Allocator.DestroyAll();
+      FreeList.clear();
+      NumInfos = 0;
+    }
+
+    /* Number of live Info objects */
+    size_t size() const { return NumInfos; }
+
+    /* Largest footprint of the Info objects of the arena so far, in bytes, without their payload */
+    size_t peakBytes() const { return PeakInfos * sizeof(Info); }
+};
+
+/*
+ * Hash-consing table of Info values: it holds one canonical Info per distinct
+ * value, so that two interned Infos are equal exactly when they are the same pointer.
+ * Canonical Infos must not be modified.
+ */
+template <class Info>
+class InfoInterner {
+  private:
+    std::unordered_multimap<size_t, Info *> Table;
+    DenseSet<Info *> Canonical;
+    // Number of equals calls made to resolve hash matches
+    uint64_t NumCompares;
+
+  public:
+    InfoInterner() : NumCompares(0) {}
+
+    /* Return the canonical Info equal to info. If there is none, info becomes canonical. */
+    Info * intern(Info * info) {
+      if (Canonical.count(info))
+        return info;
+
+      size_t hash = info->hash();
+      auto range = Table.equal_range(hash);
+      for (auto it = range.first; it != range.second; ++it) {
+        ++NumCompares;
+        if (Info::equals(it->second, info))
+          return it->second;
+      }
+      Table.insert(std::make_pair(hash, info));
+      Canonical.insert(info);
+      return info;
+    }
+
+    bool isCanonical(Info * info) const { return Canonical.count(info); }
+
+    /* Number of distinct values */
+    size_t size() const { return Canonical.size(); }
+
+    uint64_t getNumCompares() const { return NumCompares; }
+
+    void clear() {
+      Table.clear();
+      Canonical.clear();
+    }
+};
+
+/*
+ * Order in which the worklist algorithm visits pending instructions.
+ *   FIFO:             first in, first out.
+ *   ReversePostOrder: the pending instruction that comes first in the reverse
+ *                     postorder of the edges. Edges of a backward analysis run
+ *                     against the CFG, so there this is the postorder of the CFG.
+ */
+enum WorklistOrder { FIFO, ReversePostOrder };
+
+/*
+ * The worklist of the dataflow framework.
+ * An instruction is queued at most once at a time; pushing an instruction that
+ * is already pending is a no-op.
+ */
+class Worklist {
+  private:
+    WorklistOrder Order;
+    // FIFO: pending instructions
+    std::deque<unsigned> Queue;
+    // ReversePostOrder: min-heap of the priorities of pending instructions
+    std::priority_queue<unsigned, std::vector<unsigned>, std::greater<unsigned>> Heap;
+    // Priority of each instruction and the instruction of each priority
+    std::vector<unsigned> Priority;
+    std::vector<unsigned> NodeAt;
+    // Whether each instruction is pending
+    std::vector<bool> InQueue;
+
+  public:
+    /*
+     * Order: the visiting order.
+     * Priorities: the position of each instruction in the order. Ignored for FIFO.
+     */
+    Worklist(WorklistOrder order, const std::vector<unsigned> & priorities, unsigned numNodes) :
+             Order(order), Priority(priorities), InQueue(numNodes, false) {
+      if (Order == ReversePostOrder) {
+        NodeAt.resize(numNodes);
+        for (unsigned n = 0; n < numNodes; ++n)
+          NodeAt[Priority[n]] = n;
+      }
+    }
+
+    bool empty() const {
+      return Order == FIFO ? Queue.empty() : Heap.empty();
+    }
+
+    void push(unsigned n) {
+      if (InQueue[n])
+        return;
+      InQueue[n] = true;
+      if (Order == FIFO)
+        Queue.push_back(n);
+      else
+        Heap.push(Priority[n]);
+    }
+
+    unsigned pop() {
+      unsigned n;
+      if (Order == FIFO) {
+        n = Queue.front();
+        Queue.pop_front();
+      } else {
+        n = NodeAt[Heap.top()];
+        Heap.pop();
+      }
+      InQueue[n] = false;
+      return n;
+    }
+};
+
+/*
+ * Counters of one run of the worklist algorithm, returned by getStats().
+ * The join time is only measured after setTimeJoins(true), because reading the
+ * clock around every join costs about as much as a small join.
+ */
+struct SolverStats {
+	// Size of the edge graph
+	unsigned NumNodes = 0;
+	unsigned NumEdges = 0;
+	// Nodes (or blocks, in block-level mode) taken off the worklist
+	uint64_t NumPops = 0;
+	// Calls of flowfunction and flowblock, including the replays of block-level mode
+	uint64_t NumFlowCalls = 0;
+	// Joins and comparisons of Info objects made by the framework and by joinInfo()
+	uint64_t NumJoins = 0;
+	uint64_t NumEquals = 0;
+	// Time spent in those joins and comparisons
+	uint64_t JoinNanos = 0;
+	// Largest number of times a single node was visited before the fixpoint was reached
+	unsigned NumIterations = 0;
+	// Instructions visited by the worklist algorithm
+	unsigned NumVisits = 0;
+	// Peak number of bytes held by the Info arena
+	size_t PeakInfoBytes = 0;
+	// Number of distinct Info values, in interning mode
+	unsigned NumDistinctInfos = 0;
+	// Wall time of runWorklistAlgorithm
+	uint64_t SolveNanos = 0;
+};
+
+/*
+ * Adds the time spent in its scope to *Nanos. Does nothing if Nanos is null.
+ */
+class ScopedNanos {
+  private:
+    uint64_t * Nanos;
+    std::chrono::steady_clock::time_point Start;
+
+  public:
+    ScopedNanos(uint64_t * nanos) : Nanos(nanos) {
+      if (Nanos)
+        Start = std::chrono::steady_clock::now();
+    }
+
+    ~ScopedNanos() {
+      if (Nanos)
+        *Nanos += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - Start).count();
+    }
 };
 
 /*
  * This is the base template class to represent the generic dataflow analysis framework
  * For a specific analysis, you need to create a sublcass of it.
+ *
+ * The subclass passes itself as Analysis (CRTP). The framework calls its flowfunction
+ * (and flowblock, if it has one) statically, without virtual dispatch.
  */
-template <class Info, bool Direction>
+template <class Info, bool Direction, class Analysis>
 class DataFlowAnalysis {
 
+  private:
+		Analysis & derived() {
+			return static_cast<Analysis &>(*this);
+		}
+
   protected:
 		typedef std::pair<unsigned, unsigned> Edge;
 		// Index to instruction map
-		std::map<unsigned, Instruction *> IndexToInstr;
+		std::vector<Instruction *> IndexToInstr;
 		// Instruction to index map
-		std::map<Instruction *, unsigned> InstrToIndex;
-		// Edge to information map
+		DenseMap<Instruction *, unsigned> InstrToIndex;
+		// Edge to information map, only used while the edges are being added
 		std::map<Edge, Info *> EdgeToInfo;
+		// Edges sorted by (source, destination). The position of an edge is its id.
+		std::vector<Edge> Edges;
+		// Edge id to information
+		std::vector<Info *> EdgeInfos;
+		// Compressed sparse row adjacency, built once by buildAdjacency().
+		// The outgoing edges of node n are the ids SuccOffsets[n] .. SuccOffsets[n + 1] - 1,
+		// the incoming edges of node n are PredEdges[PredOffsets[n]] .. PredEdges[PredOffsets[n + 1] - 1].
+		std::vector<unsigned> SuccOffsets;
+		std::vector<unsigned> PredOffsets;
+		std::vector<unsigned> PredEdges;
 		// The bottom of the lattice
     	Info Bottom;
     	// The initial state of the analysis
 		Info InitialState;
 		// EntryInstr points to the first instruction to be processed in the analysis
 		Instruction * EntryInstr;
+		// Owner of all the Info objects created by the worklist algorithm and the flow functions
+		InfoArena<Info> Arena;
+		// Visiting order of the worklist
+		WorklistOrder Order;
+		// Number of instructions (or blocks, in block-level mode) visited by the last run of the worklist algorithm
+		unsigned NumVisits;
+		// Whether the fixpoint is computed over basic blocks instead of instructions
+		bool BlockLevel;
+		// Block-level mode: whether the edges inside blocks hold their final information
+		bool Materialized;
+		// Boundary mode: the edges inside blocks hold no information (null), except
+		// while their block is replayed
+		bool BoundaryOnly;
+		// Basic blocks in function order, and the block id of each instruction (the dummy node has none)
+		std::vector<BasicBlock *> Blocks;
+		std::vector<unsigned> NodeBlock;
+		// Counters of the last run of the worklist algorithm
+		SolverStats Stats;
+		// Whether the time spent in joins is measured
+		bool TimeJoins;
+		// Interning mode: every edge holds a canonical Info of Interner
+		bool Interning;
+		InfoInterner<Info> Interner;
+		// The function solved by the last runWorklistAlgorithm, and its control flow
+		// graph, from which rerunWorklistAlgorithm can start
+		typedef std::vector<std::pair<BasicBlock *, std::vector<BasicBlock *>>> BlockGraph;
+		Function * SolvedFunc;
+		BlockGraph SolvedCFG;
+		// Demand-driven queries: the function being queried, and the nodes whose
+		// outgoing edges already hold their final information
+		Function * QueryFunc;
+		std::vector<bool> QuerySolved;
+		// Parallel mode: number of threads solving the components of the block graph
+		unsigned SolverThreads;
+		// Set while the worker threads run. Each of them then has its own arena and
+		// counters, and the interner is locked.
+		bool InParallel;
+		// The arena and counters of a worker thread. The Infos a worker creates live as
+		// long as the analysis, since the edges keep them.
+		struct Worker {
+			InfoArena<Info> Arena;
+			SolverStats Stats;
+		};
+		std::vector<std::unique_ptr<Worker>> Workers;
+		std::mutex InternLock;
 
 
 		/*
@@ -103,19 +613,32 @@ class DataFlowAnalysis {
 			// Dummy instruction null has index 0;
 			// Any real instruction's index > 0.
 			InstrToIndex[nullptr] = 0;
-			IndexToInstr[0] = nullptr;
+			IndexToInstr.push_back(nullptr);
 
 			unsigned counter = 1;
 			for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
 				Instruction * instr = &*I;
 				InstrToIndex[instr] = counter;
-				IndexToInstr[counter] = instr;
+				IndexToInstr.push_back(instr);
 				counter++;
 			}
 
 			return;
 		}
 
+		/*
+		 * Utility function:
+		 *   Get the index of V, or 0 if V is not an instruction of the function.
+		 *   Unlike InstrToIndex[V], it never inserts into the map.
+		 */
+		unsigned getIndex(Value * V) const {
+			Instruction * instr = dyn_cast_or_null<Instruction>(V);
+			if (!instr)
+				return 0;
+			auto it = InstrToIndex.find(instr);
+			return it == InstrToIndex.end() ? 0 : it->second;
+		}
+
 		/*
 		 * Utility function:
 		 *   Get incoming edges of the instruction identified by index.
@@ -124,40 +647,803 @@ class DataFlowAnalysis {
 		void getIncomingEdges(unsigned index, std::vector<unsigned> * IncomingEdges) {
 			assert(IncomingEdges->size() == 0 && "IncomingEdges should be empty.");
 
+			for (unsigned i = PredOffsets[index]; i < PredOffsets[index + 1]; ++i)
+				IncomingEdges->push_back(Edges[PredEdges[i]].first);
+
+			return;
+		}
+
+		/*
+		 * Utility function:
+		 *   Get incoming edges of the instruction identified by index.
+		 *   OutgoingEdges stores the indices of the destination instructions of the outgoing edges.
+		 */
+		void getOutgoingEdges(unsigned index, std::vector<unsigned> * OutgoingEdges) {
+			assert(OutgoingEdges->size() == 0 && "OutgoingEdges should be empty.");
+
+			for (unsigned id = SuccOffsets[index]; id < SuccOffsets[index + 1]; ++id)
+				OutgoingEdges->push_back(Edges[id].second);
+
+			return;
+		}
+
+		/*
+		 * Utility function:
+		 *   Insert an edge to EdgeToInfo.
+		 *   The default initial value for each edge is bottom.
+		 */
+		void addEdge(Instruction * src, Instruction * dst, Info * content) {
+			Edge edge = std::make_pair(getIndex(src), getIndex(dst));
+			if (EdgeToInfo.count(edge) == 0)
+				EdgeToInfo[edge] = content;
+			return;
+		}
+
+		/*
+		 * Utility function:
+		 *   Move EdgeToInfo into the flat edge arrays and build the predecessor and
+		 *   successor adjacency of every instruction. Called once after the map has
+		 *   been initialized, so that each visit of the worklist costs only the degree
+		 *   of the instruction.
+		 */
+		void buildAdjacency() {
+			unsigned numNodes = IndexToInstr.size();
+
+			Edges.clear();
+			EdgeInfos.clear();
+			Edges.reserve(EdgeToInfo.size());
+			EdgeInfos.reserve(EdgeToInfo.size());
+			SuccOffsets.assign(numNodes + 1, 0);
+			PredOffsets.assign(numNodes + 1, 0);
+
+			// EdgeToInfo is ordered by (source, destination), so the outgoing
+			// edges of each node end up contiguous.
 			for (auto const &it : EdgeToInfo) {
-				if (it.first.second == index)
-					IncomingEdges->push_back(it.first.first);
+				Edges.push_back(it.first);
+				EdgeInfos.push_back(it.second);
+				SuccOffsets[it.first.first + 1]++;
+				PredOffsets[it.first.second + 1]++;
+			}
+
+			for (unsigned n = 0; n < numNodes; ++n) {
+				SuccOffsets[n + 1] += SuccOffsets[n];
+				PredOffsets[n + 1] += PredOffsets[n];
+			}
+
+			std::vector<unsigned> next(PredOffsets.begin(), PredOffsets.end() - 1);
+			PredEdges.resize(Edges.size());
+			for (unsigned id = 0; id < Edges.size(); ++id)
+				PredEdges[next[Edges[id].second]++] = id;
+
+			EdgeToInfo.clear();
+			return;
+		}
+
+		/*
+		 * Utility function:
+		 *   Create a new Info. It is owned by the analysis and released together with it,
+		 *   so callers must not delete it.
+		 */
+		Info * newInfo() {
+			return arena().create();
+		}
+
+		/* The worker of the calling thread while the worker threads run */
+		static Worker *& currentWorker() {
+			static thread_local Worker * worker = nullptr;
+			return worker;
+		}
+
+		/* The arena and counters of the calling thread */
+		InfoArena<Info> & arena() {
+			return InParallel ? currentWorker()->Arena : Arena;
+		}
+
+		SolverStats & stats() {
+			return InParallel ? currentWorker()->Stats : Stats;
+		}
+
+		/* Interner.intern and Interner.isCanonical, which worker threads share */
+		Info * internInfo(Info * info) {
+			if (!InParallel)
+				return Interner.intern(info);
+			std::lock_guard<std::mutex> lock(InternLock);
+			return Interner.intern(info);
+		}
+
+		bool isCanonical(Info * info) {
+			if (!InParallel)
+				return Interner.isCanonical(info);
+			std::lock_guard<std::mutex> lock(InternLock);
+			return Interner.isCanonical(info);
+		}
+
+		/*
+		 * Utility function:
+		 *   Get the id of the edge src->dst.
+		 */
+		unsigned getEdgeId(unsigned src, unsigned dst) {
+			auto first = Edges.begin() + SuccOffsets[src];
+			auto last = Edges.begin() + SuccOffsets[src + 1];
+			auto it = std::lower_bound(first, last, std::make_pair(src, dst));
+			assert(it != last && it->second == dst && "Edge does not exist.");
+			return it - Edges.begin();
+		}
+
+		/*
+		 * Utility function:
+		 *   Get the information of the edge src->dst.
+		 */
+		Info * getEdgeInfo(unsigned src, unsigned dst) {
+			return EdgeInfos[getEdgeId(src, dst)];
+		}
+
+		/*
+		 * Utility function:
+		 *   Join src into dst with Info::joinInto, counting the join in the
+		 *   statistics. Return true if dst changed.
+		 */
+		bool joinInfo(Info * dst, Info * src) {
+			ScopedNanos timer(joinTimer());
+			++stats().NumJoins;
+			return Info::joinInto(dst, src);
+		}
+
+		/* Where the time of a join goes, or null if joins are not timed */
+		uint64_t * joinTimer() {
+			return TimeJoins ? &stats().JoinNanos : nullptr;
+		}
+
+		/*
+		 * Utility function:
+		 *   Number the instructions in reverse postorder of the edges, starting from the
+		 *   dummy node 0. Instructions that cannot be reached from it (e.g. a loop that
+		 *   never reaches a return, for a backward analysis) are numbered after the others.
+		 */
+		std::vector<unsigned> computeReversePostOrder() {
+			unsigned numNodes = IndexToInstr.size();
+			std::vector<unsigned> priority(numNodes);
+			std::vector<unsigned> postOrder;
+			std::vector<bool> visited(numNodes, false);
+			// DFS stack of (node, next outgoing edge id)
+			std::vector<std::pair<unsigned, unsigned>> stack;
+			unsigned rank = 0;
+
+			postOrder.reserve(numNodes);
+			for (unsigned root = 0; root < numNodes; ++root) {
+				if (visited[root])
+					continue;
+				visited[root] = true;
+				stack.push_back(std::make_pair(root, SuccOffsets[root]));
+
+				while (!stack.empty()) {
+					unsigned n = stack.back().first;
+					unsigned next = stack.back().second;
+					if (next == SuccOffsets[n + 1]) {
+						postOrder.push_back(n);
+						stack.pop_back();
+						continue;
+					}
+					stack.back().second++;
+					unsigned succ = Edges[next].second;
+					if (!visited[succ]) {
+						visited[succ] = true;
+						stack.push_back(std::make_pair(succ, SuccOffsets[succ]));
+					}
+				}
+
+				// Rank the tree of this root before any later root
+				for (unsigned i = postOrder.size(); i > 0; --i)
+					priority[postOrder[i - 1]] = rank++;
+				postOrder.clear();
 			}
 
-			return;
+			return priority;
+		}
+
+		/*
+		 * Utility function:
+		 *   Number the basic blocks and record the block of each instruction.
+		 */
+		void assignIndiceToBlocks(Function * func) {
+			Blocks.clear();
+			NodeBlock.assign(IndexToInstr.size(), ~0u);
+			for (Function::iterator bi = func->begin(), e = func->end(); bi != e; ++bi) {
+				BasicBlock * block = &*bi;
+				for (auto ii = block->begin(), ie = block->end(); ii != ie; ++ii)
+					NodeBlock[getIndex(&*ii)] = Blocks.size();
+				Blocks.push_back(block);
+			}
+			derived().initializeBlockCaches();
+		}
+
+		/* The number of a block, once the blocks are numbered */
+		unsigned getBlockId(BasicBlock * BB) const {
+			return NodeBlock[getIndex(&BB->front())];
+		}
+
+		/*
+		 * Utility function:
+		 *   The instruction of a block that receives the edges entering it, and the one
+		 *   whose outgoing edges all leave it. Every other edge of the block is internal.
+		 */
+		unsigned getBlockEntry(unsigned block) {
+			BasicBlock * BB = Blocks[block];
+			return getIndex(Direction ? &BB->front() : (Instruction *)BB->getTerminator());
+		}
+
+		unsigned getBlockExit(unsigned block) {
+			BasicBlock * BB = Blocks[block];
+			return getIndex(Direction ? (Instruction *)BB->getTerminator() : &BB->front());
+		}
+
+		/*
+		 * Utility function:
+		 *   Run the flow function over the instructions of a block in flow order,
+		 *   storing the results on the edges inside the block. The information for the
+		 *   edges leaving the block is returned in Infos, in the order of the outgoing
+		 *   edges of getBlockExit(block).
+		 */
+		void replayBlock(unsigned block, std::vector<Info *> & Infos) {
+			unsigned exitIdx = getBlockExit(block);
+			unsigned first = getIndex(&Blocks[block]->front());
+			unsigned last = getIndex((Instruction *)Blocks[block]->getTerminator());
+
+			for (unsigned k = 0; k <= last - first; ++k) {
+				unsigned instrIdx = Direction ? first + k : last - k;
+
+				std::vector<unsigned> incomeEdges;
+				std::vector<unsigned> outgoEdges;
+				std::vector<Info *> flowInfos;
+
+				getIncomingEdges(instrIdx, &incomeEdges);
+				getOutgoingEdges(instrIdx, &outgoEdges);
+				++stats().NumFlowCalls;
+				derived().flowfunction(IndexToInstr[instrIdx], incomeEdges, outgoEdges, flowInfos);
+
+				if (instrIdx == exitIdx) {
+					Infos = flowInfos;
+					continue;
+				}
+				// Boundary mode gives these back right after the replay; interning
+				// them would keep them
+				bool intern = Interning && !BoundaryOnly;
+				for (unsigned i = 0; i < outgoEdges.size(); ++i)
+					EdgeInfos[SuccOffsets[instrIdx] + i] = intern ? internInfo(flowInfos[i]) : flowInfos[i];
+				if (intern)
+					releaseInfos(flowInfos);
+			}
+		}
+
+		/*
+		 * Boundary mode:
+		 *   Give back the informations that replayBlock left on the edges inside the
+		 *   block, or, with clear, those initializeEdges put there.
+		 */
+		void releaseInnerEdges(unsigned block, bool clear = false) {
+			unsigned exitIdx = getBlockExit(block);
+			unsigned first = getIndex(&Blocks[block]->front());
+			unsigned last = getIndex((Instruction *)Blocks[block]->getTerminator());
+
+			std::vector<Info *> infos;
+			for (unsigned n = first; n <= last; ++n) {
+				if (n == exitIdx)
+					continue;
+				for (unsigned e = SuccOffsets[n]; e < SuccOffsets[n + 1]; ++e) {
+					if (!clear)
+						infos.push_back(EdgeInfos[e]);
+					EdgeInfos[e] = nullptr;
+				}
+			}
+			releaseInfos(infos);
+		}
+
+		/*
+		 * Block-level mode:
+		 *   Compute the information of the edges inside blocks from the solved
+		 *   information on the edges between blocks, in one linear pass.
+		 */
+		void materializeEdges() {
+			if (SolverThreads > 1) {
+				// Each replay only writes the edges inside its block
+				std::atomic<unsigned> next(0);
+				runWorkers([&]() {
+					for (unsigned b = next++; b < Blocks.size(); b = next++)
+						materializeBlock(b);
+				});
+			} else {
+				for (unsigned b = 0; b < Blocks.size(); ++b)
+					materializeBlock(b);
+			}
+			Materialized = true;
+		}
+
+		void materializeBlock(unsigned block) {
+			std::vector<Info *> unused;
+			replayBlock(block, unused);
+			if (Interning)
+				releaseInfos(unused);
+		}
+
+		/*
+		 * The worklist algorithm of block-level mode. Only the edges between blocks
+		 * are updated; each visit applies the transfer function of a whole block.
+		 */
+		void runBlockWorklist(Function * func) {
+			assignIndiceToBlocks(func);
+			Materialized = false;
+
+			std::vector<unsigned> seeds;
+			for (unsigned b = 0; b < Blocks.size(); ++b)
+				seeds.push_back(b);
+
+			// Without block summaries, the last replay of each block saw its final
+			// incoming information, so the edges inside blocks are already final.
+			Materialized = !(SolverThreads > 1 ? solveComponents() : solveBlocks(seeds));
+		}
+
+		/*
+		 * Run the block-level worklist from the blocks in seeds until the fixpoint.
+		 * Return true if flowblock summaries were used, which leaves the edges inside
+		 * the visited blocks out of date.
+		 */
+		bool solveBlocks(const std::vector<unsigned> & seeds) {
+			unsigned numBlocks = Blocks.size();
+			Worklist worklist(Order, computeBlockPriorities(), numBlocks);
+
+			for (unsigned b : seeds)
+				worklist.push(b);
+
+			NumVisits = 0;
+			bool usedSummary = false;
+			std::vector<unsigned> visits(numBlocks, 0);
+			while (!worklist.empty()) {
+				unsigned block = worklist.pop();
+				++NumVisits;
+				Stats.NumIterations = std::max(Stats.NumIterations, ++visits[block]);
+
+				if (visitBlock(block, [&](unsigned succ) { worklist.push(succ); }))
+					usedSummary = true;
+			}
+
+			return usedSummary;
+		}
+
+		/* The worklist priorities of the blocks: the reverse postorder of their entry instructions */
+		std::vector<unsigned> computeBlockPriorities() {
+			std::vector<unsigned> priorities;
+			if (Order != ReversePostOrder)
+				return priorities;
+
+			unsigned numBlocks = Blocks.size();
+			std::vector<unsigned> nodePriorities = computeReversePostOrder();
+			std::vector<std::pair<unsigned, unsigned>> ranked;
+			for (unsigned b = 0; b < numBlocks; ++b)
+				ranked.push_back(std::make_pair(nodePriorities[getBlockEntry(b)], b));
+			std::sort(ranked.begin(), ranked.end());
+			priorities.resize(numBlocks);
+			for (unsigned r = 0; r < numBlocks; ++r)
+				priorities[ranked[r].second] = r;
+			return priorities;
+		}
+
+		/*
+		 * One visit of the block-level worklist: apply the transfer function of block
+		 * to the join of the edges entering it, and update the edges leaving it. push
+		 * is called with the block each changed edge enters. Return true if a
+		 * flowblock summary was used.
+		 */
+		template <class PushFn>
+		bool visitBlock(unsigned block, PushFn push) {
+			unsigned entryIdx = getBlockEntry(block);
+			unsigned exitIdx = getBlockExit(block);
+			++stats().NumPops;
+
+			std::vector<unsigned> outgoEdges;
+			std::vector<Info *> flowInfos;
+			getOutgoingEdges(exitIdx, &outgoEdges);
+
+			Info * in = newInfo();
+			{
+				ScopedNanos timer(joinTimer());
+				for (unsigned i = PredOffsets[entryIdx]; i < PredOffsets[entryIdx + 1]; ++i) {
+					++stats().NumJoins;
+					Info::join(in, EdgeInfos[PredEdges[i]], in);
+				}
+			}
+
+			++stats().NumFlowCalls;
+			bool usedSummary = derived().flowblock(Blocks[block], in, outgoEdges, flowInfos);
+			if (!usedSummary)
+				replayBlock(block, flowInfos);
+
+			for (unsigned i = 0; i < outgoEdges.size(); ++i) {
+				unsigned e = SuccOffsets[exitIdx] + i;
+
+				if (updateEdge(e, flowInfos[i]))
+					push(NodeBlock[outgoEdges[i]]);
+			}
+
+			// The edges own their informations, so what the visit created can be
+			// reused, which bounds the arena in boundary mode
+			if (Interning || BoundaryOnly) {
+				flowInfos.push_back(in);
+				releaseInfos(flowInfos);
+			}
+			if (BoundaryOnly && !usedSummary)
+				releaseInnerEdges(block);
+			return usedSummary;
+		}
+
+		/*
+		 * Parallel mode:
+		 *   The block-level worklist algorithm, run on the strongly connected
+		 *   components of the block graph (in the flow direction). The edges entering a
+		 *   component only come from components before it in topological order, so a
+		 *   component is solved to its fixpoint, on its own worklist, as soon as those
+		 *   are done; components that do not depend on each other are solved at the
+		 *   same time by the worker threads. The result is the one of solveBlocks.
+		 */
+		bool solveComponents() {
+			unsigned numBlocks = Blocks.size();
+			std::vector<unsigned> priorities = computeBlockPriorities();
+			std::vector<unsigned> comp;
+			std::vector<std::vector<unsigned>> members;
+			findComponents(comp, members);
+
+			// The worklist of a component pops its blocks in the global order
+			for (auto & blocks : members)
+				if (!priorities.empty())
+					std::sort(blocks.begin(), blocks.end(), [&](unsigned a, unsigned b) {
+						return priorities[a] < priorities[b];
+					});
+
+			// The components each one flows into (once per edge), and the number of
+			// edges from unsolved components into each one
+			std::vector<std::vector<unsigned>> succComps(members.size());
+			std::vector<unsigned> pending(members.size(), 0);
+			for (unsigned b = 0; b < numBlocks; ++b) {
+				unsigned exitIdx = getBlockExit(b);
+				for (unsigned e = SuccOffsets[exitIdx]; e < SuccOffsets[exitIdx + 1]; ++e) {
+					unsigned c = comp[NodeBlock[Edges[e].second]];
+					if (c != comp[b]) {
+						succComps[comp[b]].push_back(c);
+						++pending[c];
+					}
+				}
+			}
+
+			std::mutex lock;
+			std::condition_variable wake;
+			std::vector<unsigned> ready;
+			unsigned remaining = members.size();
+			for (unsigned c = 0; c < members.size(); ++c)
+				if (!pending[c])
+					ready.push_back(c);
+
+			std::vector<unsigned> local(numBlocks);
+			std::vector<unsigned> visits(numBlocks, 0);
+			std::atomic<bool> usedSummary(false);
+			runWorkers([&]() {
+				std::unique_lock<std::mutex> guard(lock);
+				while (true) {
+					wake.wait(guard, [&]() { return !ready.empty() || !remaining; });
+					if (!remaining)
+						return;
+					unsigned c = ready.back();
+					ready.pop_back();
+					guard.unlock();
+
+					if (solveComponent(members[c], comp, local, visits))
+						usedSummary = true;
+
+					guard.lock();
+					--remaining;
+					for (unsigned succ : succComps[c])
+						if (!--pending[succ])
+							ready.push_back(succ);
+					wake.notify_all();
+				}
+			});
+
+			NumVisits = Stats.NumPops;
+			return usedSummary;
+		}
+
+		/*
+		 * Parallel mode:
+		 *   Solve the component made of blocks, whose incoming edges from other
+		 *   components are final. local and visits are indexed by block; the thread
+		 *   solving a component only touches the entries of its blocks.
+		 */
+		bool solveComponent(const std::vector<unsigned> & blocks, const std::vector<unsigned> & comp,
+		                    std::vector<unsigned> & local, std::vector<unsigned> & visits) {
+			unsigned c = comp[blocks[0]];
+			std::vector<unsigned> priorities(blocks.size());
+			for (unsigned i = 0; i < blocks.size(); ++i) {
+				local[blocks[i]] = i;
+				priorities[i] = i;
+			}
+			Worklist worklist(Order, priorities, blocks.size());
+			for (unsigned i = 0; i < blocks.size(); ++i)
+				worklist.push(i);
+
+			bool usedSummary = false;
+			while (!worklist.empty()) {
+				unsigned block = blocks[worklist.pop()];
+				stats().NumIterations = std::max(stats().NumIterations, ++visits[block]);
+
+				auto push = [&](unsigned succ) {
+					if (comp[succ] == c)
+						worklist.push(local[succ]);
+				};
+				if (visitBlock(block, push))
+					usedSummary = true;
+			}
+			return usedSummary;
+		}
+
+		/*
+		 * Parallel mode:
+		 *   The strongly connected components of the block graph, by Tarjan's
+		 *   algorithm: comp holds the component of each block, and members the blocks
+		 *   of each component in block order.
+		 */
+		void findComponents(std::vector<unsigned> & comp, std::vector<std::vector<unsigned>> & members) {
+			unsigned numBlocks = Blocks.size();
+			std::vector<unsigned> exits(numBlocks);
+			for (unsigned b = 0; b < numBlocks; ++b)
+				exits[b] = getBlockExit(b);
+
+			std::vector<unsigned> order(numBlocks, ~0u);
+			std::vector<unsigned> low(numBlocks);
+			std::vector<bool> onStack(numBlocks, false);
+			std::vector<unsigned> stack;
+			// DFS stack of (block, next outgoing edge id)
+			std::vector<std::pair<unsigned, unsigned>> dfs;
+			unsigned counter = 0;
+			auto enter = [&](unsigned b) {
+				order[b] = low[b] = counter++;
+				stack.push_back(b);
+				onStack[b] = true;
+				dfs.push_back(std::make_pair(b, SuccOffsets[exits[b]]));
+			};
+
+			comp.assign(numBlocks, ~0u);
+			members.clear();
+			for (unsigned root = 0; root < numBlocks; ++root) {
+				if (order[root] != ~0u)
+					continue;
+				enter(root);
+
+				while (!dfs.empty()) {
+					unsigned b = dfs.back().first;
+					unsigned e = dfs.back().second;
+					if (e < SuccOffsets[exits[b] + 1]) {
+						dfs.back().second++;
+						unsigned succ = NodeBlock[Edges[e].second];
+						if (order[succ] == ~0u)
+							enter(succ);
+						else if (onStack[succ])
+							low[b] = std::min(low[b], order[succ]);
+						continue;
+					}
+
+					dfs.pop_back();
+					if (!dfs.empty())
+						low[dfs.back().first] = std::min(low[dfs.back().first], low[b]);
+					if (low[b] != order[b])
+						continue;
+
+					members.emplace_back();
+					unsigned m;
+					do {
+						m = stack.back();
+						stack.pop_back();
+						onStack[m] = false;
+						comp[m] = members.size() - 1;
+						members.back().push_back(m);
+					} while (m != b);
+					std::sort(members.back().begin(), members.back().end());
+				}
+			}
+		}
+
+		/*
+		 * Parallel mode:
+		 *   Run work on SolverThreads threads, the calling one included, each with its
+		 *   own worker, then add the counters of the workers to Stats.
+		 */
+		template <class WorkFn>
+		void runWorkers(WorkFn work) {
+			while (Workers.size() < SolverThreads)
+				Workers.emplace_back(new Worker());
+
+			InParallel = true;
+			auto run = [&](unsigned t) {
+				currentWorker() = Workers[t].get();
+				work();
+				currentWorker() = nullptr;
+			};
+			std::vector<std::thread> threads;
+			for (unsigned t = 1; t < SolverThreads; ++t)
+				threads.emplace_back(run, t);
+			run(0);
+			for (auto & thread : threads)
+				thread.join();
+			InParallel = false;
+
+			for (auto & worker : Workers) {
+				SolverStats & S = worker->Stats;
+				Stats.NumPops += S.NumPops;
+				Stats.NumFlowCalls += S.NumFlowCalls;
+				Stats.NumJoins += S.NumJoins;
+				Stats.NumEquals += S.NumEquals;
+				Stats.JoinNanos += S.JoinNanos;
+				Stats.NumIterations = std::max(Stats.NumIterations, S.NumIterations);
+				S = SolverStats();
+			}
+		}
+
+		typedef std::integral_constant<bool, HasJoinInto<Info>::value> UseJoinInto;
+
+		/*
+		 * Utility function:
+		 *   Give every edge its own copy of its initial information, so that
+		 *   joinInto can update the edges in place. Edges initially share Bottom.
+		 */
+		void ownEdgeInfos(std::true_type) {
+			for (unsigned e = 0; e < EdgeInfos.size(); ++e)
+				if (EdgeInfos[e])
+					ownEdgeInfo(e, std::true_type());
+		}
+
+		void ownEdgeInfos(std::false_type) {}
+
+		void ownEdgeInfo(unsigned e, std::true_type) {
+			Info * own = newInfo();
+			Info::joinInto(own, EdgeInfos[e]);
+			EdgeInfos[e] = own;
+		}
+
+		void ownEdgeInfo(unsigned e, std::false_type) {}
+
+		/*
+		 * Utility function:
+		 *   Join info into the information of edge e.
+		 *   Return true if the information of the edge changed.
+		 */
+		bool updateEdge(unsigned e, Info * info) {
+			if (Interning)
+				return updateInternedEdge(e, info);
+			return updateEdge(e, info, UseJoinInto());
+		}
+
+		bool updateEdge(unsigned e, Info * info, std::true_type) {
+			return joinInfo(EdgeInfos[e], info);
+		}
+
+		bool updateEdge(unsigned e, Info * info, std::false_type) {
+			Info * result = newInfo();
+			bool same;
+			{
+				ScopedNanos timer(joinTimer());
+				++stats().NumJoins;
+				++stats().NumEquals;
+				Info::join(EdgeInfos[e], info, result);
+				same = Info::equals(EdgeInfos[e], result);
+			}
+
+			if (same)
+				return false;
+			EdgeInfos[e] = result;
+			return true;
+		}
+
+		/*
+		 * Interning mode:
+		 *   The edges start with the interned initial informations, and an update
+		 *   replaces the Info of the edge by the interned join. The edge changed
+		 *   exactly when the pointer did.
+		 */
+		void internEdgeInfos() {
+			for (unsigned e = 0; e < EdgeInfos.size(); ++e)
+				if (EdgeInfos[e])
+					EdgeInfos[e] = Interner.intern(EdgeInfos[e]);
+		}
+
+		bool updateInternedEdge(unsigned e, Info * info) {
+			Info * old = EdgeInfos[e];
+			if (info == old)
+				return false;
+
+			Info * result = newInfo();
+			{
+				ScopedNanos timer(joinTimer());
+				++stats().NumJoins;
+				Info::join(old, info, result);
+			}
+
+			Info * canonical = internInfo(result);
+			if (canonical != result)
+				arena().release(result);
+			if (canonical == old)
+				return false;
+			EdgeInfos[e] = canonical;
+			return true;
+		}
+
+		/*
+		 * Interning mode:
+		 *   Recycle the Infos returned by a flow function once the edges have been
+		 *   updated, except those that became canonical.
+		 */
+		void releaseInfos(std::vector<Info *> & Infos) {
+			std::sort(Infos.begin(), Infos.end());
+			Infos.erase(std::unique(Infos.begin(), Infos.end()), Infos.end());
+			for (Info * info : Infos)
+				if (info && !isCanonical(info))
+					arena().release(info);
 		}
 
 		/*
-		 * Utility function:
-		 *   Get incoming edges of the instruction identified by index.
-		 *   OutgoingEdges stores the indices of the destination instructions of the outgoing edges.
+		 * Incremental re-analysis:
+		 *   A copy of old with its instruction indices renamed by newIndex, for an edge
+		 *   of the renumbered function. The solved Infos themselves are left alone,
+		 *   since canonical ones must not be modified.
 		 */
-		void getOutgoingEdges(unsigned index, std::vector<unsigned> * OutgoingEdges) {
-			assert(OutgoingEdges->size() == 0 && "OutgoingEdges should be empty.");
+		Info * remapInfo(Info * old, const std::vector<unsigned> & newIndex, std::true_type) {
+			Info * info = newInfo();
+			*info = *old;
+			info->remap(newIndex);
+			if (!Interning)
+				return info;
 
-			for (auto const &it : EdgeToInfo) {
-				if (it.first.first == index)
-					OutgoingEdges->push_back(it.first.second);
-			}
+			Info * canonical = Interner.intern(info);
+			if (canonical != info)
+				Arena.release(info);
+			return canonical;
+		}
 
-			return;
+		Info * remapInfo(Info * old, const std::vector<unsigned> & newIndex, std::false_type) {
+			llvm_unreachable("renumbering needs Info::remap");
 		}
 
 		/*
-		 * Utility function:
-		 *   Insert an edge to EdgeToInfo.
-		 *   The default initial value for each edge is bottom.
+		 * Incremental re-analysis:
+		 *   Give edge e back the information it starts with in a full run.
+		 *   initializeEdges left it there unowned and uninterned.
 		 */
-		void addEdge(Instruction * src, Instruction * dst, Info * content) {
-			Edge edge = std::make_pair(InstrToIndex[src], InstrToIndex[dst]);
-			if (EdgeToInfo.count(edge) == 0)
-				EdgeToInfo[edge] = content;
-			return;
+		void resetEdgeInfo(unsigned e) {
+			if (Interning)
+				EdgeInfos[e] = Interner.intern(EdgeInfos[e]);
+			else
+				ownEdgeInfo(e, UseJoinInto());
+		}
+
+		/*
+		 * The payload of the Infos of the edges, each counted once since interned
+		 * edges share them.
+		 */
+		size_t edgePayloadBytes(std::true_type) const {
+			SmallPtrSet<const Info *, 32> seen;
+			size_t bytes = 0;
+			for (const Info * info : EdgeInfos)
+				if (info && seen.insert(info).second)
+					bytes += info->payloadBytes();
+			return bytes;
+		}
+
+		size_t edgePayloadBytes(std::false_type) const {
+			return 0;
+		}
+
+		/* The blocks of func in order, each with its successors in order */
+		static BlockGraph getCFG(Function * func) {
+			BlockGraph graph;
+			for (BasicBlock & BB : *func)
+				graph.push_back(std::make_pair(&BB, std::vector<BasicBlock *>(succ_begin(&BB), succ_end(&BB))));
+			return graph;
 		}
 
 		/*
@@ -218,6 +1504,53 @@ class DataFlowAnalysis {
 		 */
 		void initializeBackwardMap(Function * func) {
 
+			assignIndiceToInstrs(func);
+
+			for (Function::iterator bi = func->begin(), e = func->end(); bi != e; ++bi) {
+				BasicBlock * block = &*bi;
+
+				Instruction * firstInstr = &(block->front());
+
+				// Initialize incoming edges to the basic block
+				for (auto pi = pred_begin(block), pe = pred_end(block); pi != pe; ++pi) {
+					BasicBlock * prev = *pi;
+					Instruction * src = (Instruction *)prev->getTerminator();
+					Instruction * dst = firstInstr;
+					addEdge(dst, src, &Bottom);
+				}
+
+				// If there is at least one phi node, add an edge from the first non-phi node
+				// to the first phi node instruction in the basic block.
+				if (isa<PHINode>(firstInstr)) {
+					addEdge(block->getFirstNonPHI(), firstInstr, &Bottom);
+				}
+
+				// Initialize edges within the basic block
+				for (auto ii = block->begin(), ie = block->end(); ii != ie; ++ii) {
+					Instruction * instr = &*ii;
+					if (isa<PHINode>(instr))
+						continue;
+					if (instr == (Instruction *)block->getTerminator())
+						break;
+					Instruction * next = instr->getNextNode();
+					addEdge(next, instr, &Bottom);
+				}
+
+				// Initialize outgoing edges of the basic block
+				Instruction * term = (Instruction *)block->getTerminator();
+				for (auto si = succ_begin(block), se = succ_end(block); si != se; ++si) {
+					BasicBlock * succ = *si;
+					Instruction * next = &(succ->front());
+					addEdge(next, term, &Bottom);
+				}
+
+			}
+
+			EntryInstr = (Instruction *) &((func->back()).back());
+			addEdge(nullptr, EntryInstr, &Bottom);
+
+			return;
+
 		}
 
     /*
@@ -228,19 +1561,249 @@ class DataFlowAnalysis {
      *   std::vector<Info *> & Infos: the vector of the newly computed information for each outgoing eages.
      *
      * Direction:
-     * 	 Implement this function in subclasses.
+     * 	 Implement this function in subclasses, with the signature
+     *
+     * 	   void flowfunction(Instruction * I,
+     * 	                     std::vector<unsigned> & IncomingEdges,
+     * 	                     std::vector<unsigned> & OutgoingEdges,
+     * 	                     std::vector<Info *> & Infos);
+     *
+     * 	 It is found through the Analysis template parameter, so it is not declared here.
+     */
+
+    /*
+     * The block-level flow function, used in block-level mode.
+     *   BasicBlock * BB: the basic block to be processed.
+     *   Info * In: the join of the information on the edges entering the block.
+     *   std::vector<unsigned> & OutgoingEdges: the indices of the destination instructions of the
+     *     edges leaving the block (the outgoing edges of its last instruction in flow order).
+     *   std::vector<Info *> & Infos: the newly computed information for each edge leaving the block.
+     *
+     * Return false if the analysis has no summary for the block. The framework then runs
+     * flowfunction over the instructions of the block instead.
+     * Subclasses with block summaries hide this default.
+     */
+    bool flowblock(BasicBlock * /* BB */,
+                           Info * /* In */,
+                           std::vector<unsigned> & /* OutgoingEdges */,
+                           std::vector<Info *> & /* Infos */) {
+    	return false;
+    }
+
+    /*
+     * Print out the information of the edge id, for print().
+     * Subclasses that keep the edge informations elsewhere hide this default.
+     */
+    void printEdgeInfo(unsigned id, raw_ostream & OS) {
+    	EdgeInfos[id]->print(OS);
+    }
+
+    /*
+     * Drop whatever the analysis caches about the IR (block summaries, for instance).
+     * initializeEdges calls it before numbering the instructions again, since the
+     * cached indices and blocks may no longer hold. Subclasses with caches hide it.
+     */
+    void invalidateCaches() {}
+
+    /*
+     * Called once the blocks are numbered (see getBlockId), before flowblock runs.
+     * In parallel mode flowblock runs on several threads at once, for different
+     * blocks, so per-block caches must be sized here rather than grown as blocks
+     * are visited. Subclasses with such caches hide it.
+     */
+    void initializeBlockCaches() {}
+
+    /*
+     * Build the edges of func with their initial information, and their adjacency.
+     * This is step (1) of runWorklistAlgorithm; analyses that compute the edge
+     * informations without the worklist algorithm start from it too.
+     */
+    void initializeEdges(Function * func) {
+    	IndexToInstr.clear();
+    	InstrToIndex.clear();
+    	SolvedFunc = nullptr;
+    	QueryFunc = nullptr;
+    	derived().invalidateCaches();
+
+    	if (Direction)
+    		initializeForwardMap(func);
+    	else
+    		initializeBackwardMap(func);
+
+    	assert(EntryInstr != nullptr && "Entry instruction is null.");
+
+    	buildAdjacency();
+    	Stats.NumNodes = IndexToInstr.size();
+    	Stats.NumEdges = Edges.size();
+    }
+
+    /*
+     * Set up the edges of func for queries, unless they already are.
+     */
+    void startQueries(Function * func) {
+    	if (BoundaryOnly) {
+    		// Queries replay the blocks of the solved function
+    		if (func != SolvedFunc)
+    			runWorklistAlgorithm(func);
+    		return;
+    	}
+    	if (func == QueryFunc)
+    		return;
+    	Stats = SolverStats();
+    	initializeEdges(func);
+    	if (Interning)
+    		internEdgeInfos();
+    	else
+    		ownEdgeInfos(UseJoinInto());
+    	QueryFunc = func;
+    	QuerySolved.assign(IndexToInstr.size(), false);
+    }
+
+    /*
+     * Run the worklist algorithm from the nodes in seeds until the fixpoint.
+     * If active is given, only the nodes it marks are put back on the worklist.
      */
-    virtual void flowfunction(Instruction * I,
-    													std::vector<unsigned> & IncomingEdges,
-															std::vector<unsigned> & OutgoingEdges,
-															std::vector<Info *> & Infos) = 0;
+    void solveNodes(const std::vector<unsigned> & seeds, const std::vector<bool> * active = nullptr) {
+    	std::vector<unsigned> priorities;
+    	if (Order == ReversePostOrder)
+    		priorities = computeReversePostOrder();
+    	Worklist worklist(Order, priorities, IndexToInstr.size());
+
+    	for (unsigned n : seeds)
+    		worklist.push(n);
+
+    	NumVisits = 0;
+    	std::vector<unsigned> visits(IndexToInstr.size(), 0);
+    	while (!worklist.empty()) {
+    		unsigned instrIdx = worklist.pop();
+    		++Stats.NumPops;
+    		if(instrIdx == 0){
+    			continue;
+    		}
+    		++NumVisits;
+    		Stats.NumIterations = std::max(Stats.NumIterations, ++visits[instrIdx]);
+
+    		std::vector<unsigned> incomeEdges;
+    		std::vector<unsigned> outgoEdges;
+
+    		getIncomingEdges(instrIdx, &incomeEdges);
+    		getOutgoingEdges(instrIdx, &outgoEdges);
+
+
+    		std::vector<Info *> flowInfos;
+
+    		++Stats.NumFlowCalls;
+    		derived().flowfunction(IndexToInstr[instrIdx], incomeEdges, outgoEdges, flowInfos);
+
+    		for (unsigned i = 0; i < outgoEdges.size(); ++i) {
+    			unsigned e = SuccOffsets[instrIdx] + i;
+
+    			if (updateEdge(e, flowInfos[i]) && (!active || (*active)[outgoEdges[i]]))
+    				worklist.push(outgoEdges[i]);
+    		}
+
+    		if (Interning)
+    			releaseInfos(flowInfos);
+
+    	}
+    }
 
   public:
-    DataFlowAnalysis(Info & bottom, Info & initialState) :
-    								 Bottom(bottom), InitialState(initialState),EntryInstr(nullptr) {}
+    DataFlowAnalysis(Info & bottom, Info & initialState, WorklistOrder order = FIFO) :
+    								 Bottom(bottom), InitialState(initialState),EntryInstr(nullptr),
+    								 Order(order), NumVisits(0), BlockLevel(false), Materialized(true), BoundaryOnly(false),
+    								 TimeJoins(false), Interning(false), SolvedFunc(nullptr),
+    								 QueryFunc(nullptr), SolverThreads(1), InParallel(false) {}
 
     virtual ~DataFlowAnalysis() {}
 
+    /*
+     * Peak number of bytes held by the Info arena of this analysis. If Info has
+     * payloadBytes(), the payload of the Infos of the edges is added: the facts
+     * of the edges only grow, so it is largest once they are solved.
+     */
+    size_t getPeakArenaSize() const {
+    	size_t bytes = Arena.peakBytes();
+    	for (auto & worker : Workers)
+    		bytes += worker->Arena.peakBytes();
+    	return bytes + edgePayloadBytes(std::integral_constant<bool, HasPayloadBytes<Info>::value>());
+    }
+
+    /*
+     * Number of instructions visited (flow function calls) by the last run of
+     * the worklist algorithm.
+     */
+    unsigned getNumVisits() const {
+    	return NumVisits;
+    }
+
+    /*
+     * Counters of the last run of the worklist algorithm.
+     */
+    SolverStats getStats() const {
+    	SolverStats stats = Stats;
+    	stats.NumVisits = NumVisits;
+    	stats.PeakInfoBytes = getPeakArenaSize();
+    	stats.NumDistinctInfos = Interner.size();
+    	stats.NumEquals += Interner.getNumCompares();
+    	return stats;
+    }
+
+    /*
+     * Select interning mode: equal informations are stored once and shared by all
+     * the edges that hold them, and edges are compared by pointer. Info must provide
+     * hash(), and the flow functions must return Infos created with newInfo() that
+     * they do not keep, since the framework recycles them.
+     * It must be chosen before runWorklistAlgorithm.
+     */
+    void setInterning(bool interning) {
+    	Interning = interning;
+    }
+
+    /*
+     * Measure the time spent in joins and comparisons (SolverStats::JoinNanos).
+     */
+    void setTimeJoins(bool timeJoins) {
+    	TimeJoins = timeJoins;
+    }
+
+    /*
+     * Select block-level mode: the fixpoint is computed over the edges between basic
+     * blocks only, using flowblock() as the transfer function of a whole block, and
+     * the edges inside blocks are filled in afterwards when print() needs them.
+     * It must be chosen before runWorklistAlgorithm.
+     */
+    void setBlockLevel(bool blockLevel) {
+    	BlockLevel = blockLevel;
+    }
+
+    /*
+     * Select boundary mode, to bound memory on very large functions: only the edges
+     * between blocks hold informations. The fixpoint is computed at block level, and
+     * print() and query() replay a block with flowfunction whenever they need the
+     * edges inside it, giving the informations back afterwards. As in interning
+     * mode, the flow functions must return Infos created with newInfo() that they do
+     * not keep. It must be chosen before runWorklistAlgorithm.
+     */
+    void setBoundaryOnly(bool boundaryOnly) {
+    	BoundaryOnly = boundaryOnly;
+    }
+
+    /*
+     * Select parallel mode, for functions too big to wait for one thread: the
+     * fixpoint is computed at block level, and the strongly connected components of
+     * the control flow graph are solved by numThreads threads, a component as soon
+     * as the ones flowing into it are done (see solveComponents). Filling in the
+     * edges inside blocks for print() is split between the threads as well.
+     * flowfunction and flowblock then run concurrently on different blocks, so they
+     * may only write to the Infos they create and to per-block state (see
+     * initializeBlockCaches). Queries and incremental re-analysis stay sequential.
+     * It must be chosen before runWorklistAlgorithm.
+     */
+    void setSolverThreads(unsigned numThreads) {
+    	SolverThreads = std::max(numThreads, 1u);
+    }
+
     /*
      * Print out the analysis results.
      *
@@ -249,12 +1812,132 @@ class DataFlowAnalysis {
      * 	 The autograder will check the output of this function.
      */
     void print() {
-			for (auto const &it : EdgeToInfo) {
-				errs() << "Edge " << it.first.first << "->" "Edge " << it.first.second << ":";
-				(it.second)->print();
+			print(errs());
+    }
+
+    /*
+     * Print out the analysis results to OS.
+     */
+    void print(raw_ostream & OS) {
+			if (BoundaryOnly) {
+				printByBlock(OS);
+				return;
+			}
+			if (!Materialized)
+				materializeEdges();
+
+			for (unsigned id = 0; id < Edges.size(); ++id)
+				printEdge(id, OS);
+    }
+
+    void printEdge(unsigned id, raw_ostream & OS) {
+			OS << "Edge " << Edges[id].first << "->" "Edge " << Edges[id].second << ":";
+			derived().printEdgeInfo(id, OS);
+    }
+
+    /*
+     * Boundary mode: print the edges in the same order, replaying one block at a
+     * time. The edges leaving the instructions of a block come one after the other,
+     * and the blocks come in index order, so only the inner edges of one block are
+     * held at once.
+     */
+    void printByBlock(raw_ostream & OS) {
+			unsigned id = 0;
+			for (; id < Edges.size() && Edges[id].first == 0; ++id)
+				printEdge(id, OS);
+
+			for (unsigned b = 0; b < Blocks.size(); ++b) {
+				std::vector<Info *> exitInfos;
+				replayBlock(b, exitInfos);
+				releaseInfos(exitInfos);
+
+				unsigned last = getIndex((Instruction *)Blocks[b]->getTerminator());
+				for (; id < Edges.size() && Edges[id].first <= last; ++id)
+					printEdge(id, OS);
+				releaseInnerEdges(b);
 			}
     }
 
+
+
+
+    /*
+     * Demand-driven query: the information entering the instruction with the given
+     * index in the flow direction (before it in a forward analysis, after it in a
+     * backward one), that is the join of its incoming edges at the fixpoint.
+     * Only the nodes from which the instruction can be reached are solved. They stay
+     * solved for the following queries on func, so a sequence of queries costs at
+     * most one run of the worklist algorithm. Queries solve instruction by
+     * instruction, in block-level mode too, and getStats() adds up their counters.
+     * In boundary mode, func is solved once and the block of the instruction is
+     * replayed instead. The result is owned by the analysis.
+     */
+    Info * query(Function * func, unsigned index) {
+    	startQueries(func);
+    	assert(index > 0 && index < IndexToInstr.size() && "No instruction with this index.");
+    	if (BoundaryOnly)
+    		return queryByReplay(index);
+
+    	// The nodes not solved yet from which index can be reached. Edges from solved
+    	// nodes into them are final, and none of them leads to a solved node.
+    	ScopedNanos solveTimer(&Stats.SolveNanos);
+    	std::vector<unsigned> seeds;
+    	std::vector<unsigned> stack;
+    	if (!QuerySolved[index]) {
+    		QuerySolved[index] = true;
+    		stack.push_back(index);
+    	}
+    	while (!stack.empty()) {
+    		unsigned n = stack.back();
+    		stack.pop_back();
+    		seeds.push_back(n);
+    		for (unsigned i = PredOffsets[n]; i < PredOffsets[n + 1]; ++i) {
+    			unsigned pred = Edges[PredEdges[i]].first;
+    			if (!QuerySolved[pred]) {
+    				QuerySolved[pred] = true;
+    				stack.push_back(pred);
+    			}
+    		}
+    	}
+    	if (!seeds.empty())
+    		solveNodes(seeds, &QuerySolved);
+
+    	Info * result = newInfo();
+    	ScopedNanos timer(joinTimer());
+    	for (unsigned i = PredOffsets[index]; i < PredOffsets[index + 1]; ++i) {
+    		++Stats.NumJoins;
+    		Info::join(result, EdgeInfos[PredEdges[i]], result);
+    	}
+    	return result;
+    }
+
+    /*
+     * Boundary mode: answer a query from the solved edges between blocks, replaying
+     * the block of the instruction.
+     */
+    Info * queryByReplay(unsigned index) {
+    	unsigned block = NodeBlock[index];
+    	std::vector<Info *> exitInfos;
+    	replayBlock(block, exitInfos);
+
+    	Info * result = newInfo();
+    	{
+    		ScopedNanos timer(joinTimer());
+    		for (unsigned i = PredOffsets[index]; i < PredOffsets[index + 1]; ++i) {
+    			++Stats.NumJoins;
+    			Info::join(result, EdgeInfos[PredEdges[i]], result);
+    		}
+    	}
+    	releaseInfos(exitInfos);
+    	releaseInnerEdges(block);
+    	return result;
+    }
+
+    Info * query(Instruction * I) {
+    	startQueries(I->getFunction());
+    	return query(I->getFunction(), getIndex(I));
+    }
+
     /*
      * This function implements the work list algorithm in the following steps:
      * (1) Initialize info of each edge to bottom
@@ -266,56 +1949,332 @@ class DataFlowAnalysis {
      *   You may not change anything before "// (2) Initialize the worklist".
      */
     void runWorklistAlgorithm(Function * func) {
-    	std::deque<unsigned> worklist;
+    	Stats = SolverStats();
+    	ScopedNanos solveTimer(&Stats.SolveNanos);
 
     	// (1) Initialize info of each edge to bottom
-    	if (Direction)
-    		initializeForwardMap(func);
+    	initializeEdges(func);
+    	if (BoundaryOnly) {
+    		assignIndiceToBlocks(func);
+    		for (unsigned b = 0; b < Blocks.size(); ++b)
+    			releaseInnerEdges(b, true);
+    	}
+    	if (Interning)
+    		internEdgeInfos();
     	else
-    		initializeBackwardMap(func);
+    		ownEdgeInfos(UseJoinInto());
+    	SolvedFunc = func;
+    	SolvedCFG = getCFG(func);
 
-    	assert(EntryInstr != nullptr && "Entry instruction is null.");
+    	if (BlockLevel || BoundaryOnly || SolverThreads > 1) {
+    		runBlockWorklist(func);
+    		return;
+    	}
 
     	// (2) Initialize the work list
-    	for (auto i = IndexToInstr.begin(); i != IndexToInstr.end(); ++i)
-    		worklist.push_back(i->first);
+    	std::vector<unsigned> seeds;
+    	for (unsigned i = 0; i < IndexToInstr.size(); ++i)
+    		seeds.push_back(i);
 
     	// (3) Compute until the work list is empty
-    	while (!worklist.empty()) {
-    		unsigned instrIdx = worklist.front();
-    		worklist.pop_front();
-    		if(instrIdx == 0){
-    			continue;
-    		}
-
-    		std::vector<unsigned> incomeEdges;
-    		std::vector<unsigned> outgoEdges;
+    	solveNodes(seeds);
+    }
 
-    		getIncomingEdges(instrIdx, &incomeEdges);
-    		getOutgoingEdges(instrIdx, &outgoEdges);
+    /*
+     * Incremental re-analysis. After runWorklistAlgorithm(func), func was edited
+     * without changing its control flow graph; Changed holds every block in which
+     * instructions were added, removed or modified (including the blocks of the
+     * users of a value that was replaced). The edge informations are brought up to
+     * date from the solved state:
+     *   - the instructions are numbered again, and the informations of the edges
+     *     that still exist are renamed with Info::remap if the numbering changed;
+     *   - the edges reachable from a changed block in the flow direction, which are
+     *     the only ones that may depend on the edit, start over from their initial
+     *     information, and only their nodes are put on the worklist.
+     * The result is the one a full run computes, as long as facts about an
+     * instruction only arise in its block and in the blocks of its users, which
+     * holds for the analyses here. The flow functions only run in the affected part
+     * of the function; renumbering and rebuilding the edges stay linear.
+     *
+     * It falls back to a full run, and returns false, if func is not the function
+     * solved last, if its control flow graph changed, if instructions were added
+     * or removed and Info has no remap(), or in boundary mode.
+     * bench/check_incremental.py checks it against full runs after random edits.
+     */
+    bool rerunWorklistAlgorithm(Function * func, const std::vector<BasicBlock *> & Changed) {
+    	bool renumbered = false;
+    	{
+    		unsigned i = 1;
+    		for (inst_iterator I = inst_begin(func), E = inst_end(func); I != E && !renumbered; ++I, ++i)
+    			renumbered = i >= IndexToInstr.size() || IndexToInstr[i] != &*I;
+    		renumbered |= i != IndexToInstr.size();
+    	}
+    	if (BoundaryOnly || func != SolvedFunc || getCFG(func) != SolvedCFG ||
+    	    (renumbered && !HasRemap<Info>::value)) {
+    		runWorklistAlgorithm(func);
+    		return false;
+    	}
 
+    	Stats = SolverStats();
+    	ScopedNanos solveTimer(&Stats.SolveNanos);
 
-    		std::vector<Info *> flowInfos;
+    	// The solved state, looked up by the indices of the old numbering
+    	std::vector<Instruction *> oldInstrs(IndexToInstr);
+    	std::vector<Edge> oldEdges;
+    	std::vector<Info *> oldInfos;
+    	std::vector<unsigned> oldSuccOffsets;
+    	oldEdges.swap(Edges);
+    	oldInfos.swap(EdgeInfos);
+    	oldSuccOffsets.swap(SuccOffsets);
 
-    		flowfunction(IndexToInstr[instrIdx], incomeEdges, outgoEdges, flowInfos);
+    	initializeEdges(func);
+    	SolvedFunc = func;
+    	unsigned numNodes = IndexToInstr.size();
 
-    		for (unsigned i = 0; i < outgoEdges.size(); ++i) {
-    			Edge e = std::make_pair(instrIdx, outgoEdges[i]);
+    	// The new index of each old instruction (~0u if it was removed), and the old
+    	// index of each new one (~0u if it was added). Removed instructions may
+    	// dangle, so they are only looked up by address.
+    	std::vector<unsigned> newIndex(oldInstrs.size(), ~0u);
+    	std::vector<unsigned> oldIndex(numNodes, ~0u);
+    	newIndex[0] = oldIndex[0] = 0;
+    	for (unsigned i = 1; i < oldInstrs.size(); ++i) {
+    		auto it = InstrToIndex.find(oldInstrs[i]);
+    		if (it != InstrToIndex.end()) {
+    			newIndex[i] = it->second;
+    			oldIndex[it->second] = i;
+    		}
+    	}
 
-    			Info * result = new Info();
-    			Info::join(EdgeToInfo[e], flowInfos[i], result);
+    	// The nodes reachable from the changed blocks
+    	std::vector<bool> affected(numNodes, false);
+    	std::vector<unsigned> stack;
+    	for (BasicBlock * BB : Changed) {
+    		for (auto ii = BB->begin(), ie = BB->end(); ii != ie; ++ii) {
+    			unsigned n = getIndex(&*ii);
+    			if (n && !affected[n]) {
+    				affected[n] = true;
+    				stack.push_back(n);
+    			}
+    		}
+    	}
+    	while (!stack.empty()) {
+    		unsigned n = stack.back();
+    		stack.pop_back();
+    		for (unsigned id = SuccOffsets[n]; id < SuccOffsets[n + 1]; ++id) {
+    			unsigned succ = Edges[id].second;
+    			if (!affected[succ]) {
+    				affected[succ] = true;
+    				stack.push_back(succ);
+    			}
+    		}
+    	}
 
-    			if (!Info::equals(EdgeToInfo[e], result)){
-    				EdgeToInfo[e] = result;
-    				worklist.push_back(outgoEdges[i]);
-    			} 
+    	// Keep the solved information of the other edges. An edge that did not exist
+    	// (into an instruction added at the top of a block) starts over, and its source
+    	// is visited again to fill it.
+    	std::vector<unsigned> seeds;
+    	for (unsigned n = 0; n < numNodes; ++n)
+    		if (affected[n])
+    			seeds.push_back(n);
+    	for (unsigned e = 0; e < Edges.size(); ++e) {
+    		unsigned src = Edges[e].first;
+    		unsigned oldSrc = oldIndex[src];
+    		unsigned oldDst = oldIndex[Edges[e].second];
+    		Info * old = nullptr;
+    		if (!affected[src] && oldSrc != ~0u && oldDst != ~0u) {
+    			auto first = oldEdges.begin() + oldSuccOffsets[oldSrc];
+    			auto last = oldEdges.begin() + oldSuccOffsets[oldSrc + 1];
+    			auto it = std::lower_bound(first, last, std::make_pair(oldSrc, oldDst));
+    			if (it != last && it->second == oldDst)
+    				old = oldInfos[it - oldEdges.begin()];
+    		}
 
+    		if (old) {
+    			EdgeInfos[e] = renumbered ? remapInfo(old, newIndex, std::integral_constant<bool, HasRemap<Info>::value>()) : old;
+    			continue;
     		}
+    		resetEdgeInfo(e);
+    		if (!affected[src])
+    			seeds.push_back(src);
+    	}
 
+    	if (!BlockLevel) {
+    		solveNodes(seeds);
+    		return true;
     	}
 
+    	assignIndiceToBlocks(func);
+    	std::vector<bool> seen(Blocks.size(), false);
+    	std::vector<unsigned> blockSeeds;
+    	for (unsigned n : seeds) {
+    		if (n != 0 && !seen[NodeBlock[n]]) {
+    			seen[NodeBlock[n]] = true;
+    			blockSeeds.push_back(NodeBlock[n]);
+    		}
+    	}
+    	// The edges inside the affected blocks were reset; bring them up to date if
+    	// the rest of the function already is
+    	if (solveBlocks(blockSeeds) && Materialized)
+    		for (unsigned b = 0; b < Blocks.size(); ++b)
+    			if (affected[getBlockEntry(b)])
+    				materializeBlock(b);
+    	return true;
     }
 };
 
+/*
+ * Module-level driver: call Analyze(F, OS) for every function with a body, on up to
+ * NumThreads threads. Each function writes its results to its own buffer, and the
+ * buffers are copied to errs() in module order, so the output is byte-identical to
+ * analyzing the functions one after another. With one thread the results go
+ * straight to stderr.
+ * Analyze must only read the IR, and must synchronize any state it shares across
+ * functions.
+ */
+template <class AnalyzeFn>
+void analyzeFunctionsInParallel(Module & M, unsigned NumThreads, AnalyzeFn Analyze) {
+	std::vector<Function *> funcs;
+	for (Function & F : M)
+		if (!F.isDeclaration())
+			funcs.push_back(&F);
+
+	if (NumThreads <= 1) {
+		// Nothing to reorder: write the results out as they come instead of holding
+		// them, through a buffer since errs() has none
+		errs().flush();
+		raw_fd_ostream OS(2, false);
+		for (Function * F : funcs)
+			Analyze(*F, OS);
+		return;
+	}
+
+	std::vector<std::string> outputs(funcs.size());
+	std::atomic<unsigned> next(0);
+	auto worker = [&]() {
+		for (unsigned i = next++; i < funcs.size(); i = next++) {
+			raw_string_ostream OS(outputs[i]);
+			Analyze(*funcs[i], OS);
+			OS.flush();
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned t = 1; t < NumThreads && t < funcs.size(); ++t)
+		threads.emplace_back(worker);
+	worker();
+	for (auto & thread : threads)
+		thread.join();
+
+	for (auto & output : outputs)
+		errs() << output;
+}
+
+/*
+ * Write the solver counters of the functions of M to the file Path, one JSON object
+ * per line in module order. Functions without an entry in Stats are skipped.
+ */
+inline void writeSolverStatsJSON(StringRef Path, StringRef Pass, Module & M,
+                                 const std::map<Function *, SolverStats> & Stats) {
+	std::error_code EC;
+	raw_fd_ostream OS(Path, EC, sys::fs::OF_Text);
+	if (EC) {
+		errs() << "error: cannot open " << Path << ": " << EC.message() << "\n";
+		return;
+	}
+
+	for (Function & F : M) {
+		auto it = Stats.find(&F);
+		if (it == Stats.end())
+			continue;
+		const SolverStats & S = it->second;
+
+		json::OStream J(OS);
+		J.object([&] {
+			J.attribute("pass", Pass);
+			J.attribute("function", F.getName());
+			J.attribute("nodes", int64_t(S.NumNodes));
+			J.attribute("edges", int64_t(S.NumEdges));
+			J.attribute("pops", int64_t(S.NumPops));
+			J.attribute("flow_calls", int64_t(S.NumFlowCalls));
+			J.attribute("joins", int64_t(S.NumJoins));
+			J.attribute("equals", int64_t(S.NumEquals));
+			J.attribute("join_ns", int64_t(S.JoinNanos));
+			J.attribute("iterations", int64_t(S.NumIterations));
+			J.attribute("peak_info_bytes", int64_t(S.PeakInfoBytes));
+			J.attribute("distinct_infos", int64_t(S.NumDistinctInfos));
+			J.attribute("solve_ns", int64_t(S.SolveNanos));
+		});
+		OS << "\n";
+	}
+}
+
+/*
+ * The solver counters of the functions a pass analyzes: summed into its -stats
+ * statistics, and kept per function for writeSolverStatsJSON if asked. Functions
+ * analyzed concurrently may record at the same time. Pass::DebugType is the
+ * DEBUG_TYPE of the pass.
+ */
+template <class Pass>
+class SolverStatsRecorder {
+	private:
+		static Statistic PeakInfoArenaSize;
+		static Statistic NumWorklistVisits;
+		static Statistic NumWorklistPops;
+		static Statistic NumFlowCalls;
+		static Statistic NumJoins;
+		static Statistic NumEquals;
+		static Statistic JoinMicros;
+		static Statistic NumNodes;
+		static Statistic NumEdges;
+		static Statistic MaxIterations;
+
+		std::mutex Lock;
+		std::map<Function *, SolverStats> FunctionStats;
+
+	public:
+		void record(Function & F, const SolverStats & S, bool KeepForJSON) {
+			std::lock_guard<std::mutex> lock(Lock);
+			NumWorklistVisits += S.NumVisits;
+			if (S.PeakInfoBytes > PeakInfoArenaSize)
+				PeakInfoArenaSize = S.PeakInfoBytes;
+			NumWorklistPops += S.NumPops;
+			NumFlowCalls += S.NumFlowCalls;
+			NumJoins += S.NumJoins;
+			NumEquals += S.NumEquals;
+			JoinMicros += S.JoinNanos / 1000;
+			NumNodes += S.NumNodes;
+			NumEdges += S.NumEdges;
+			if (S.NumIterations > MaxIterations)
+				MaxIterations = S.NumIterations;
+			if (KeepForJSON)
+				FunctionStats[&F] = S;
+		}
+
+		void writeJSON(StringRef Path, Module & M) {
+			writeSolverStatsJSON(Path, Pass::DebugType, M, FunctionStats);
+		}
+};
+
+template <class Pass> Statistic SolverStatsRecorder<Pass>::PeakInfoArenaSize = {Pass::DebugType,
+	"PeakInfoArenaSize", "Peak size of the Info arena of a function, with the payload of the Infos (bytes)"};
+template <class Pass> Statistic SolverStatsRecorder<Pass>::NumWorklistVisits = {Pass::DebugType,
+	"NumWorklistVisits", "Number of instructions visited by the worklist algorithm"};
+template <class Pass> Statistic SolverStatsRecorder<Pass>::NumWorklistPops = {Pass::DebugType,
+	"NumWorklistPops", "Number of nodes taken off the worklist"};
+template <class Pass> Statistic SolverStatsRecorder<Pass>::NumFlowCalls = {Pass::DebugType,
+	"NumFlowCalls", "Number of flow function calls"};
+template <class Pass> Statistic SolverStatsRecorder<Pass>::NumJoins = {Pass::DebugType,
+	"NumJoins", "Number of Info joins"};
+template <class Pass> Statistic SolverStatsRecorder<Pass>::NumEquals = {Pass::DebugType,
+	"NumEquals", "Number of Info comparisons"};
+template <class Pass> Statistic SolverStatsRecorder<Pass>::JoinMicros = {Pass::DebugType,
+	"JoinMicros", "Time spent in Info joins and comparisons (us), if measured"};
+template <class Pass> Statistic SolverStatsRecorder<Pass>::NumNodes = {Pass::DebugType,
+	"NumNodes", "Number of nodes of the edge graphs"};
+template <class Pass> Statistic SolverStatsRecorder<Pass>::NumEdges = {Pass::DebugType,
+	"NumEdges", "Number of edges of the edge graphs"};
+template <class Pass> Statistic SolverStatsRecorder<Pass>::MaxIterations = {Pass::DebugType,
+	"MaxIterations", "Largest number of visits of one node before a fixpoint"};
+
 }
 #endif // End LLVM_231DFA_H
@@ -1,55 +1,77 @@
 #include "llvm/Pass.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Timer.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/IR/InstIterator.h"
 
 #include "231DFA.h"
-#include <set>
 #include <string>
 
 
 using namespace llvm;
 using namespace std;
 
-namespace {
+#define DEBUG_TYPE "cse231-reaching"
 
-  class ReachingInfo : public Info{
-    public:
+static cl::opt<unsigned> ReachingThreads("reaching-threads", cl::init(1),
+    cl::desc("Number of functions to analyze concurrently"));
 
-      ReachingInfo() {}
+static cl::opt<std::string> ReachingStatsJSON("reaching-stats-json", cl::value_desc("filename"),
+    cl::desc("Write the solver counters of each function to this file as JSON lines"));
 
-      set<unsigned> defInstrs;
+static cl::opt<bool> ReachingIntern("reaching-intern",
+    cl::desc("Store equal informations once and share them between edges"));
 
-      /* Print out the information */
-      void print(){
-        for(auto def : defInstrs)
-          errs() << def << "|";
-        errs() << "\n";
-      }
+static cl::list<unsigned> ReachingQuery("reaching-query", cl::CommaSeparated, cl::value_desc("indices"),
+    cl::desc("Only print the information entering these instructions, solving just what they depend on"));
 
-      /* Compare two pieces of information */
-      static bool equals(ReachingInfo * info1, ReachingInfo * info2){
-        return info1->defInstrs == info2->defInstrs;
-      }
+static cl::opt<unsigned> ReachingBoundaryLimit("reaching-boundary-limit", cl::init(1000000),
+    cl::desc("Number of instructions above which only the informations between blocks are stored"));
 
-      /* Join two pieces of information.
-         The third parameter points to the result. */
-      static ReachingInfo * join(ReachingInfo * info1, ReachingInfo * info2, ReachingInfo * result){
-        if (!equals(result, info1))
-          result->defInstrs.insert(info1->defInstrs.begin(), info1->defInstrs.end());
-        if (!equals(result, info2))
-          result->defInstrs.insert(info2->defInstrs.begin(), info2->defInstrs.end());
-        return result;
-      }
+static cl::opt<unsigned> ReachingSolverThreads("reaching-solver-threads", cl::init(1),
+    cl::desc("Number of threads solving the strongly connected components of the CFG of one function"));
+
+namespace {
+
+  /* The set of definitions (instruction indices) reaching a program point */
+  class ReachingInfo : public BitVectorInfo {
+    public:
+
+      ReachingInfo() {}
 
   };
 
 
-  class ReachingDefinitionAnalysis : public DataFlowAnalysis<ReachingInfo, true> {
+  class ReachingDefinitionAnalysis : public DataFlowAnalysis<ReachingInfo, true, ReachingDefinitionAnalysis> {
+
+    private:
+      // The definitions of each block, by block id. In SSA form nothing is killed,
+      // so the transfer function of a block is out = in U BlockGen[block].
+      std::vector<ReachingInfo *> BlockGen;
+
+      /* Instructions that define a value (category 1) */
+      static bool isCategory1(Instruction * I) {
+        switch (I->getOpcode()) {
+          case Instruction::Alloca:
+          case Instruction::Load:
+          case Instruction::GetElementPtr:
+          case Instruction::ICmp:
+          case Instruction::FCmp:
+          case Instruction::Select:
+            return true;
+          default:
+            return I->isBinaryOp();
+        }
+      }
 
     public:
       ReachingDefinitionAnalysis(ReachingInfo & bottom, ReachingInfo & initialState) :
-                     DataFlowAnalysis(bottom, initialState) {}
+                     DataFlowAnalysis(bottom, initialState, ReversePostOrder) {
+        setBlockLevel(true);
+      }
 
 
       void flowfunction(Instruction * I,
@@ -57,31 +79,29 @@ namespace {
                         std::vector<unsigned> & OutgoingEdges,
                         std::vector<ReachingInfo *> & Infos) {
 
-        unsigned instrIdx = InstrToIndex[I];
+        unsigned instrIdx = getIndex(I);
 
         // join the incoming data flows
-        ReachingInfo * tempInfo = new ReachingInfo();
+        ReachingInfo * tempInfo = newInfo();
         for (auto incoming : IncomingEdges) {
-          Edge e = std::make_pair(incoming, instrIdx);
-          ReachingInfo::join(tempInfo, EdgeToInfo[e], tempInfo);
-        }
-
-        string opName = I->getOpcodeName();
-
-        // category 1
-        if (opName == "alloca" || opName == "load" || opName == "getelementptr" || 
-            opName == "icmp" || opName == "fcmp" || opName == "select" ||
-            I->isBinaryOp()) {
-
-          tempInfo->defInstrs.insert(instrIdx);
+          joinInfo(tempInfo, getEdgeInfo(incoming, instrIdx));
         }
 
-        // category 3
-        if(opName == "phi"){     
-          Instruction * firstNonPhi = I->getParent()->getFirstNonPHI();
-          unsigned firstNonPhiIdx = InstrToIndex[firstNonPhi];
-          for (unsigned i = instrIdx; i < firstNonPhiIdx; ++i)
-            tempInfo->defInstrs.insert(i);
+        switch (I->getOpcode()) {
+          // category 3
+          case Instruction::PHI: {
+            Instruction * firstNonPhi = I->getParent()->getFirstNonPHI();
+            unsigned firstNonPhiIdx = getIndex(firstNonPhi);
+            for (unsigned i = instrIdx; i < firstNonPhiIdx; ++i)
+              tempInfo->insert(i);
+            break;
+          }
+
+          // category 1
+          default:
+            if (isCategory1(I))
+              tempInfo->insert(instrIdx);
+            break;
         }
 
         for(unsigned i = 0; i < OutgoingEdges.size(); ++i){
@@ -89,26 +109,91 @@ namespace {
         }
 
       }
+
+      /* The block definitions hold instruction indices, which change when the IR does */
+      void invalidateCaches() {
+        BlockGen.clear();
+      }
+
+      void initializeBlockCaches() {
+        BlockGen.assign(Blocks.size(), nullptr);
+      }
+
+      bool flowblock(BasicBlock * BB,
+                     ReachingInfo * In,
+                     std::vector<unsigned> & OutgoingEdges,
+                     std::vector<ReachingInfo *> & Infos) {
+        ReachingInfo *& gen = BlockGen[getBlockId(BB)];
+        if (!gen) {
+          gen = newInfo();
+          for (auto ii = BB->begin(), ie = BB->end(); ii != ie; ++ii) {
+            Instruction * I = &*ii;
+            if (isCategory1(I) || isa<PHINode>(I))
+              gen->insert(getIndex(I));
+          }
+        }
+
+        ReachingInfo * out = newInfo();
+        ReachingInfo::join(In, gen, out);
+        for (unsigned i = 0; i < OutgoingEdges.size(); ++i)
+          Infos.push_back(out);
+        return true;
+      }
   };
 
 
 
-  struct ReachingDefinitionAnalysisPass : public FunctionPass {
+  struct ReachingDefinitionAnalysisPass : public ModulePass {
     static char ID;
+    static constexpr const char * DebugType = DEBUG_TYPE;
+    // Solver counters of the functions, for -stats and the JSON report
+    SolverStatsRecorder<ReachingDefinitionAnalysisPass> Stats;
 
-    ReachingDefinitionAnalysisPass() : FunctionPass(ID) {}
+    ReachingDefinitionAnalysisPass() : ModulePass(ID) {}
 
-    bool runOnFunction(Function &F) override {
+    void analyzeFunction(Function &F, raw_ostream &OS) {
       ReachingInfo bottom;
       ReachingInfo initialState;
 
       ReachingDefinitionAnalysis rda(bottom, initialState);
-      rda.runWorklistAlgorithm(&F);
-      rda.print();
-      return false;
+      rda.setInterning(ReachingIntern);
+      rda.setBoundaryOnly(F.getInstructionCount() > ReachingBoundaryLimit);
+      rda.setSolverThreads(ReachingSolverThreads);
+      rda.setTimeJoins(TimePassesIsEnabled || !ReachingStatsJSON.empty());
+
+      // The timers of a region cannot run on several threads at once
+      bool timePhases = TimePassesIsEnabled && ReachingThreads <= 1;
+      if (!ReachingQuery.empty()) {
+        // Demand-driven: only what the queried instructions depend on is solved
+        for (unsigned index : ReachingQuery) {
+          if (index == 0 || index > F.getInstructionCount())
+            continue;
+          OS << "Instr " << index << ":";
+          rda.query(&F, index)->print(OS);
+        }
+      } else {
+        {
+          NamedRegionTimer T("solve", "Solve", DEBUG_TYPE, "Reaching definition analysis", timePhases);
+          rda.runWorklistAlgorithm(&F);
+        }
+        {
+          NamedRegionTimer T("print", "Print", DEBUG_TYPE, "Reaching definition analysis", timePhases);
+          rda.print(OS);
+        }
+      }
+
+      Stats.record(F, rda.getStats(), !ReachingStatsJSON.empty());
     }
 
-  }; 
+    bool runOnModule(Module &M) override {
+      analyzeFunctionsInParallel(M, ReachingThreads, [this](Function &F, raw_ostream &OS) {
+        analyzeFunction(F, OS);
+      });
+      if (!ReachingStatsJSON.empty())
+        Stats.writeJSON(ReachingStatsJSON, M);
+      return false;
+    }
+  };
 
 }  
 
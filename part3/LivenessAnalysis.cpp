@@ -1,52 +1,263 @@
 #include "llvm/Pass.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Timer.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/IR/InstIterator.h"
 
 #include "231DFA.h"
-#include <set>
+#include <map>
 #include <string>
 
 
 using namespace llvm;
 using namespace std;
 
+#define DEBUG_TYPE "cse231-liveness"
+
+static cl::opt<unsigned> LivenessThreads("liveness-threads", cl::init(1),
+    cl::desc("Number of functions to analyze concurrently"));
+
+static cl::opt<std::string> LivenessStatsJSON("liveness-stats-json", cl::value_desc("filename"),
+    cl::desc("Write the solver counters of each function to this file as JSON lines"));
+
+static cl::opt<bool> LivenessIntern("liveness-intern",
+    cl::desc("Store equal informations once and share them between edges"));
+
+static cl::list<unsigned> LivenessQuery("liveness-query", cl::CommaSeparated, cl::value_desc("indices"),
+    cl::desc("Only print the information entering these instructions, solving just what they depend on"));
+
+static cl::opt<unsigned> LivenessBoundaryLimit("liveness-boundary-limit", cl::init(1000000),
+    cl::desc("Number of instructions above which only the informations between blocks are stored"));
+
+static cl::opt<unsigned> LivenessSolverThreads("liveness-solver-threads", cl::init(1),
+    cl::desc("Number of threads solving the strongly connected components of the CFG of one function"));
+
+static cl::opt<bool> LivenessSparse("liveness-sparse",
+    cl::desc("Propagate each value from its uses instead of running the worklist algorithm"));
+
 namespace {
 
-   class LivenessInfo : public Info{
+   /* The set of live values (instruction indices) at a program point */
+   class LivenessInfo : public BitVectorInfo {
       public:
 
          LivenessInfo() {}
 
-         set<unsigned> lives;
+   };
+
 
-         /* Print out the information */
-         void print(){
-           for(auto def : lives)
-             errs() << def << "|";
-           errs() << "\n";
+   class LivenessAnalysis : public DataFlowAnalysis<LivenessInfo, false, LivenessAnalysis> {
+
+      private:
+         /*
+          * Transfer function of a whole block: out[k] = Gen U (in - Kill) U PhiUses[k],
+          * where k is the index of the terminator of the predecessor the edge goes to.
+          */
+         struct BlockSummary {
+            LivenessInfo * Gen = nullptr;
+            LivenessInfo * Kill = nullptr;
+            std::map<unsigned, LivenessInfo *> PhiUses;
+         };
+
+         // By block id; Gen is null until the summary of the block is computed
+         std::vector<BlockSummary> Summaries;
+
+         // Sparse mode: the live values of edge id are
+         // LiveValues[LiveOffsets[id]] .. LiveValues[LiveOffsets[id + 1] - 1], in increasing order.
+         bool Sparse;
+         std::vector<unsigned> LiveOffsets;
+         std::vector<unsigned> LiveValues;
+
+         /* Instructions that define a value and kill it (category 1) */
+         static bool isCategory1(Instruction * I) {
+            switch (I->getOpcode()) {
+               case Instruction::Alloca:
+               case Instruction::Load:
+               case Instruction::GetElementPtr:
+               case Instruction::ICmp:
+               case Instruction::FCmp:
+               case Instruction::Select:
+                  return true;
+               default:
+                  return I->isBinaryOp();
+            }
          }
 
-         /* Compare two pieces of information */
-         static bool equals(LivenessInfo * info1, LivenessInfo * info2){
-           return info1->lives == info2->lives;
+         /* info U operands */
+         void addOperands(Instruction * I, LivenessInfo * info) {
+            for (unsigned i = 0; i < I->getNumOperands(); ++i) {
+               Instruction * operand = (Instruction *)I->getOperand(i);
+               if (unsigned operandIdx = getIndex(operand)) {
+                  info->insert(operandIdx);
+               }
+            }
+         }
+
+         /* info U {ValuetoInstr(v_ij)|label_ij == label}, over the phi nodes of block BB */
+         void addPhiUses(BasicBlock * BB, unsigned labelInstrIdx, LivenessInfo * info) {
+            for (auto ii = BB->begin(); isa<PHINode>(ii); ++ii) {
+               PHINode * phiInstr = cast<PHINode>(&*ii);
+
+               for (unsigned j = 0; j < phiInstr->getNumIncomingValues(); ++j) {
+                  Instruction * value = (Instruction *)(phiInstr->getIncomingValue(j));
+                  Instruction * labelInstr = (Instruction *)phiInstr->getIncomingBlock(j)->getTerminator();
+
+                  unsigned valueIdx = getIndex(value);
+                  if (valueIdx != 0 && getIndex(labelInstr) == labelInstrIdx) {
+                     info->insert(valueIdx);
+                  }
+               }
+            }
          }
 
-         /* Join two pieces of information.
-            The third parameter points to the result. */
-         static LivenessInfo * join(LivenessInfo * info1, LivenessInfo * info2, LivenessInfo * result){
-           result->lives.insert(info1->lives.begin(), info1->lives.end());
-           result->lives.insert(info2->lives.begin(), info2->lives.end());
-           return result;
+         /* The node whose flow function removes the value of instruction v, or 0 if none does */
+         unsigned getKiller(unsigned v) {
+            Instruction * I = IndexToInstr[v];
+            if (isa<PHINode>(I))
+               return getIndex(&I->getParent()->front());
+            return isCategory1(I) ? v : 0;
          }
-   };
 
+         /* Compose the flow functions of the instructions of BB, from the terminator up */
+         BlockSummary & getSummary(BasicBlock * BB) {
+            BlockSummary & summary = Summaries[getBlockId(BB)];
+            if (summary.Gen)
+               return summary;
+
+            summary.Gen = newInfo();
+            summary.Kill = newInfo();
+
+            Instruction * firstNonPhi = BB->getFirstNonPHI();
+            for (Instruction * I = (Instruction *)BB->getTerminator(); ; I = I->getPrevNode()) {
+               // Gen' = (Gen U operands) - {index}, Kill' = Kill U {index}
+               addOperands(I, summary.Gen);
+               if (isCategory1(I)) {
+                  summary.Gen->erase(getIndex(I));
+                  summary.Kill->insert(getIndex(I));
+               }
+               if (I == firstNonPhi)
+                  break;
+            }
+
+            if (isa<PHINode>(BB->front())) {
+               for (unsigned i = getIndex(&BB->front()); i < getIndex(firstNonPhi); ++i) {
+                  summary.Gen->erase(i);
+                  summary.Kill->insert(i);
+               }
+               for (auto pi = pred_begin(BB), pe = pred_end(BB); pi != pe; ++pi) {
+                  unsigned labelInstrIdx = getIndex((Instruction *)(*pi)->getTerminator());
+                  if (summary.PhiUses.count(labelInstrIdx))
+                     continue;
+                  LivenessInfo * uses = newInfo();
+                  addPhiUses(BB, labelInstrIdx, uses);
+                  summary.PhiUses[labelInstrIdx] = uses;
+               }
+            }
 
-   class LivenessAnalysis : public DataFlowAnalysis<LivenessInfo, false> {
+            return summary;
+         }
 
       public:
          LivenessAnalysis(LivenessInfo & bottom, LivenessInfo & initialState) :
-                     DataFlowAnalysis<LivenessInfo, false>(bottom, initialState) {}
+                     DataFlowAnalysis(bottom, initialState, ReversePostOrder), Sparse(false) {
+            setBlockLevel(true);
+         }
+
+         /*
+          * Sparse backend: compute the same edge informations as runWorklistAlgorithm
+          * without a fixpoint. A value is live on an edge exactly when the edge can be
+          * reached from an edge where a flow function adds the value (a use) without
+          * going through the node that removes it (its definition, or the first phi of
+          * its block). Each value is propagated once from its uses, so the cost is the
+          * total size of the live ranges rather than instructions x iterations.
+          */
+         void runSparse(Function * func) {
+            Stats = SolverStats();
+            ScopedNanos solveTimer(&Stats.SolveNanos);
+            Sparse = true;
+            // The sparse results are compact already and need no replay
+            setBoundaryOnly(false);
+            initializeEdges(func);
+
+            unsigned numNodes = IndexToInstr.size();
+            unsigned numEdges = Edges.size();
+
+            // (value, edge) pairs where the flow function of the source of the edge adds the value
+            std::vector<std::pair<unsigned, unsigned>> uses;
+            for (unsigned n = 1; n < numNodes; ++n) {
+               Instruction * I = IndexToInstr[n];
+               if (isa<PHINode>(I)) {
+                  for (unsigned e = SuccOffsets[n]; e < SuccOffsets[n + 1]; ++e) {
+                     LivenessInfo phiUses;
+                     addPhiUses(I->getParent(), Edges[e].second, &phiUses);
+                     phiUses.forEach([&](unsigned v) { uses.push_back(std::make_pair(v, e)); });
+                  }
+                  continue;
+               }
+               for (unsigned i = 0; i < I->getNumOperands(); ++i) {
+                  if (unsigned v = getIndex(I->getOperand(i))) {
+                     for (unsigned e = SuccOffsets[n]; e < SuccOffsets[n + 1]; ++e)
+                        uses.push_back(std::make_pair(v, e));
+                  }
+               }
+            }
+            std::sort(uses.begin(), uses.end());
+
+            // Search along the edges from the uses of each value, in increasing order of
+            // values. A mark holds the last value that reached an edge or a node.
+            std::vector<std::pair<unsigned, unsigned>> live;
+            std::vector<unsigned> edgeMark(numEdges, 0);
+            std::vector<unsigned> nodeMark(numNodes, 0);
+            std::vector<unsigned> stack;
+            auto reach = [&](unsigned e, unsigned v) {
+               if (edgeMark[e] == v)
+                  return;
+               edgeMark[e] = v;
+               live.push_back(std::make_pair(e, v));
+               stack.push_back(Edges[e].second);
+            };
+
+            for (unsigned u = 0; u < uses.size(); ) {
+               unsigned v = uses[u].first;
+               unsigned killer = getKiller(v);
+               for (; u < uses.size() && uses[u].first == v; ++u)
+                  reach(uses[u].second, v);
+
+               while (!stack.empty()) {
+                  unsigned n = stack.back();
+                  stack.pop_back();
+                  if (n == killer || nodeMark[n] == v)
+                     continue;
+                  nodeMark[n] = v;
+                  for (unsigned e = SuccOffsets[n]; e < SuccOffsets[n + 1]; ++e)
+                     reach(e, v);
+               }
+            }
+
+            // Group the values by edge; the values of each edge stay in increasing order
+            LiveOffsets.assign(numEdges + 1, 0);
+            for (auto & p : live)
+               LiveOffsets[p.first + 1]++;
+            for (unsigned e = 0; e < numEdges; ++e)
+               LiveOffsets[e + 1] += LiveOffsets[e];
+            std::vector<unsigned> next(LiveOffsets.begin(), LiveOffsets.end() - 1);
+            LiveValues.resize(live.size());
+            for (auto & p : live)
+               LiveValues[next[p.first]++] = p.second;
+         }
+
+         void printEdgeInfo(unsigned id, raw_ostream & OS) {
+            if (!Sparse) {
+               DataFlowAnalysis::printEdgeInfo(id, OS);
+               return;
+            }
+            for (unsigned i = LiveOffsets[id]; i < LiveOffsets[id + 1]; ++i)
+               OS << LiveValues[i] << "|";
+            OS << "\n";
+         }
 
          void flowfunction(Instruction * I,
                            std::vector<unsigned> & IncomingEdges,
@@ -54,121 +265,145 @@ namespace {
                            std::vector<LivenessInfo *> & Infos) {
 
             Infos.resize(OutgoingEdges.size());
+            // The phis after the first of a block have no edges: nothing to compute
+            if (OutgoingEdges.empty())
+               return;
 
-            unsigned instrIdx = InstrToIndex[I];
+            unsigned instrIdx = getIndex(I);
 
             // join the incoming data flows
-            LivenessInfo * tempInfo = new LivenessInfo();
+            LivenessInfo * tempInfo = newInfo();
     
             for (auto incoming : IncomingEdges) {
-               Edge e = std::make_pair(incoming, instrIdx);
-               LivenessInfo::join(EdgeToInfo[e], tempInfo, tempInfo);
+               joinInfo(tempInfo, getEdgeInfo(incoming, instrIdx));
             }
 
-            string opName = I->getOpcodeName();
+            switch (I->getOpcode()) {
+               // category 3: out[k] = in[1] U ... U - {result_i|i} U {ValuetoInstr(v_ij)|label k == label_ij}
+               case Instruction::PHI: {
+                  Instruction * firstNonPhi = I->getParent()->getFirstNonPHI();
+                  unsigned firstNonPhiIdx = getIndex(firstNonPhi);
 
-            // category 1： in[1] U ... U in[k] U operands - {index}
-            if (opName == "alloca" || opName == "load" || opName == "getelementptr" || 
-                opName == "icmp" || opName == "fcmp" || opName == "select" ||
-                I->isBinaryOp()) {
-
-               for (unsigned i = 0; i < I->getNumOperands(); ++i) {
-                  Instruction * operand = (Instruction *)I->getOperand(i);
-                  if (InstrToIndex.find(operand) != InstrToIndex.end()) {
-                     tempInfo->lives.insert(InstrToIndex[operand]);
+                  // - {result_i|i}
+                  for (unsigned i = instrIdx; i < firstNonPhiIdx; ++i) {
+                     tempInfo->erase(i);
                   }
-               } 
 
-               tempInfo->lives.erase(instrIdx);
-
-               for (unsigned k = 0; k < OutgoingEdges.size(); ++k) {
-                  LivenessInfo* newInfo = new LivenessInfo();
-                  newInfo->lives = tempInfo->lives;
-                  Infos[k] = newInfo;
-               }
-            }
-
-            // category 3: out[k] = in[1] U ... U - {result_i|i} U {ValuetoInstr(v_ij)|label k == label_ij}
-            else if(opName == "phi"){ 
-
-               Instruction * firstNonPhi = I->getParent()->getFirstNonPHI();
-               unsigned firstNonPhiIdx = InstrToIndex[firstNonPhi];
-
-               // - {result_i|i}
-               for (unsigned i = instrIdx; i < firstNonPhiIdx; ++i) {
-                  tempInfo->lives.erase(i);
-               }
-
-               for(unsigned j = 0; j < Infos.size() ; ++j){
-                  Infos[j] = new LivenessInfo();
-                  Infos[j]->lives = tempInfo->lives;
+                  // U {ValuetoInstr(v_ij)|label k == label_ij}; the last edge takes tempInfo itself
+                  unsigned last = OutgoingEdges.size() - 1;
+                  for (unsigned k = 0; k < last; ++k) {
+                     Infos[k] = newInfo();
+                     Infos[k]->Words = tempInfo->Words;
+                     addPhiUses(I->getParent(), OutgoingEdges[k], Infos[k]);
+                  }
+                  Infos[last] = tempInfo;
+                  addPhiUses(I->getParent(), OutgoingEdges[last], tempInfo);
+                  return;
                }
 
-               // U {ValuetoInstr(v_ij)|label k == label_ij}
-               for (unsigned i =instrIdx; i < firstNonPhiIdx ; ++i) {
-                  Instruction * instr = IndexToInstr[i];
+               // category 1: in[1] U ... U in[k] U operands - {index}
+               // category 2: in[1] U ... U in[k] U operands
+               default:
+                  addOperands(I, tempInfo);
+                  if (isCategory1(I))
+                     tempInfo->erase(instrIdx);
 
-                  PHINode * phiInstr = (PHINode *) instr;
-
-                  for(unsigned j = 0; j < phiInstr->getNumIncomingValues(); ++j){
-
-                     Instruction * value = (Instruction *)(phiInstr->getIncomingValue(j));
-
-                     if(InstrToIndex.find(value) != InstrToIndex.end()){
+                  // The framework only reads the results, so the outgoing edges can share one
+                  for (unsigned k = 0; k < OutgoingEdges.size(); ++k) {
+                     Infos[k] = tempInfo;
+                  }
+                  return;
+            }
+         }
 
-                        BasicBlock * label = phiInstr->getIncomingBlock(j);
-                        Instruction * labelInstr = (Instruction *)label->getTerminator();
-                        unsigned labelInstrIdx = InstrToIndex[labelInstr];
+         /* The summaries hold instruction indices, which change when the IR does */
+         void invalidateCaches() {
+            Summaries.clear();
+         }
 
-                        for(unsigned k = 0; k < OutgoingEdges.size(); ++k){
+         void initializeBlockCaches() {
+            Summaries.assign(Blocks.size(), BlockSummary());
+         }
 
-                           if(OutgoingEdges[k] == labelInstrIdx){
-                              Infos[k]->lives.insert(InstrToIndex[value]);
-                           }
-                        }
-                     }
-                  }   
-               }
-            }
+         bool flowblock(BasicBlock * BB,
+                        LivenessInfo * In,
+                        std::vector<unsigned> & OutgoingEdges,
+                        std::vector<LivenessInfo *> & Infos) {
+            BlockSummary & summary = getSummary(BB);
 
-            // category 2: in[1] U ... U in[k] U operands
-            else{
-               for (unsigned i = 0; i < I->getNumOperands(); ++i) {
-                  Instruction * operand = (Instruction *)I->getOperand(i);
-                  if (InstrToIndex.find(operand) != InstrToIndex.end()) {
-                     tempInfo->lives.insert(InstrToIndex[operand]);
-                  }
-               } 
+            LivenessInfo * out = newInfo();
+            LivenessInfo::transfer(out, In, summary.Gen, summary.Kill);
 
-               for (unsigned k = 0; k < OutgoingEdges.size(); ++k) {
-                  LivenessInfo* newInfo = new LivenessInfo();
-                  newInfo->lives = tempInfo->lives;
-                  Infos[k] = newInfo;
+            for (unsigned k = 0; k < OutgoingEdges.size(); ++k) {
+               auto uses = summary.PhiUses.find(OutgoingEdges[k]);
+               if (uses == summary.PhiUses.end()) {
+                  Infos.push_back(out);
+                  continue;
                }
+               LivenessInfo * phiOut = newInfo();
+               LivenessInfo::join(out, uses->second, phiOut);
+               Infos.push_back(phiOut);
             }
-
-            delete tempInfo;
+            return true;
          }
       };
 
 
 
 
-   struct LivenessAnalysisPass : public FunctionPass {
-       static char ID;
+   struct LivenessAnalysisPass : public ModulePass {
+     static char ID;
+     static constexpr const char * DebugType = DEBUG_TYPE;
+     // Solver counters of the functions, for -stats and the JSON report
+     SolverStatsRecorder<LivenessAnalysisPass> Stats;
+
+     LivenessAnalysisPass() : ModulePass(ID) {}
 
-       LivenessAnalysisPass() : FunctionPass(ID) {}
+     void analyzeFunction(Function &F, raw_ostream &OS) {
+       LivenessInfo bottom;
 
-       bool runOnFunction(Function &F) override {
-         LivenessInfo bottom;
+       LivenessAnalysis la(bottom, bottom);
+       la.setInterning(LivenessIntern);
+       la.setBoundaryOnly(F.getInstructionCount() > LivenessBoundaryLimit);
+       la.setSolverThreads(LivenessSolverThreads);
+       la.setTimeJoins(TimePassesIsEnabled || !LivenessStatsJSON.empty());
 
-         LivenessAnalysis la(bottom, bottom);
-         la.runWorklistAlgorithm(&F);
-         la.print();
-         return false;
+       // The timers of a region cannot run on several threads at once
+       bool timePhases = TimePassesIsEnabled && LivenessThreads <= 1;
+       if (!LivenessQuery.empty()) {
+         // Demand-driven: only what the queried instructions depend on is solved
+         for (unsigned index : LivenessQuery) {
+           if (index == 0 || index > F.getInstructionCount())
+             continue;
+           OS << "Instr " << index << ":";
+           la.query(&F, index)->print(OS);
+         }
+       } else {
+         {
+           NamedRegionTimer T("solve", "Solve", DEBUG_TYPE, "Liveness analysis", timePhases);
+           if (LivenessSparse)
+             la.runSparse(&F);
+           else
+             la.runWorklistAlgorithm(&F);
+         }
+         {
+           NamedRegionTimer T("print", "Print", DEBUG_TYPE, "Liveness analysis", timePhases);
+           la.print(OS);
+         }
        }
 
-   }; 
+       Stats.record(F, la.getStats(), !LivenessStatsJSON.empty());
+     }
+
+     bool runOnModule(Module &M) override {
+       analyzeFunctionsInParallel(M, LivenessThreads, [this](Function &F, raw_ostream &OS) {
+         analyzeFunction(F, OS);
+       });
+       if (!LivenessStatsJSON.empty())
+         Stats.writeJSON(LivenessStatsJSON, M);
+       return false;
+     }
+   };
 
 }  
 
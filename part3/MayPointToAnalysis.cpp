@@ -1,10 +1,16 @@
 #include "llvm/Pass.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SparseBitVector.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Timer.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/IR/InstIterator.h"
 
 #include "231DFA.h"
-#include <set>
+#include <algorithm>
+#include <iterator>
 #include <string>
 #include <map>
 
@@ -12,177 +18,786 @@
 using namespace llvm;
 using namespace std;
 
+#define DEBUG_TYPE "cse231-maypointto"
+
+static cl::opt<unsigned> MaypointtoThreads("maypointto-threads", cl::init(1),
+    cl::desc("Number of functions to analyze concurrently"));
+
+static cl::opt<std::string> MaypointtoStatsJSON("maypointto-stats-json", cl::value_desc("filename"),
+    cl::desc("Write the solver counters of each function to this file as JSON lines"));
+
+static cl::opt<bool> MaypointtoIntern("maypointto-intern",
+    cl::desc("Store equal informations once and share them between edges"));
+
+static cl::list<unsigned> MaypointtoQuery("maypointto-query", cl::CommaSeparated, cl::value_desc("indices"),
+    cl::desc("Only print the information entering these instructions, solving just what they depend on"));
+
+static cl::opt<unsigned> MaypointtoBoundaryLimit("maypointto-boundary-limit", cl::init(1000000),
+    cl::desc("Number of instructions above which only the informations between blocks are stored"));
+
+enum MayPointToMode { PreciseMode, SteensgaardMode, AndersenMode, AutoMode };
+
+static cl::opt<MayPointToMode> MaypointtoMode("maypointto-mode", cl::init(PreciseMode),
+    cl::desc("How the may-point-to information is computed"),
+    cl::values(clEnumValN(PreciseMode, "precise", "Flow-sensitive worklist algorithm"),
+               clEnumValN(SteensgaardMode, "steensgaard",
+                          "Flow-insensitive unification, the same information on every edge"),
+               clEnumValN(AndersenMode, "andersen",
+                          "Flow-insensitive inclusion constraints, the same information on every edge"),
+               clEnumValN(AutoMode, "auto",
+                          "steensgaard for functions larger than -maypointto-auto-limit, precise otherwise")));
+
+static cl::opt<unsigned> MaypointtoAutoLimit("maypointto-auto-limit", cl::init(5000),
+    cl::desc("Number of instructions above which -maypointto-mode=auto uses steensgaard"));
+
 // "R"/"M", index
 typedef pair<char, unsigned> pointerInfo;
 
 namespace {
 
+  /*
+   * The pointers (registers Ri and memory objects Mi) that may point to something,
+   * each with the memory objects it may point to. Pointees are always memory
+   * objects, so they are kept as a bit vector of their indices.
+   * The pointers are stored in a vector sorted by key. The hash, a sum over all the
+   * (pointer, pointee) pairs, and the number of pairs are kept up to date as pairs
+   * are added, so two different informations are usually told apart in O(1).
+   */
   class MayPointToInfo : public Info {
+    public:
+      struct Entry {
+        pointerInfo Key;
+        SparseBitVector<> Pointees;
+        // Contribution of the entry to Hash and NumPairs
+        size_t Hash;
+        unsigned Count;
+      };
+
+    private:
+      std::vector<Entry> Entries;
+      size_t Hash;
+      unsigned NumPairs;
+
+      static bool keyLess(const Entry & entry, pointerInfo key) {
+        return entry.Key < key;
+      }
+
+      /* Recompute the contribution of an entry whose pointees changed */
+      void rehash(Entry & entry) {
+        Hash -= entry.Hash;
+        NumPairs -= entry.Count;
+        entry.Hash = 0;
+        entry.Count = 0;
+        for (unsigned o : entry.Pointees) {
+          entry.Hash += hash_combine(entry.Key.first, entry.Key.second, o);
+          ++entry.Count;
+        }
+        Hash += entry.Hash;
+        NumPairs += entry.Count;
+      }
+
     public:
 
-      MayPointToInfo() {}
+      MayPointToInfo() : Hash(0), NumPairs(0) {}
 
-      map<pointerInfo, set<pointerInfo>> pointerMap;
+      std::vector<Entry>::const_iterator begin() const { return Entries.begin(); }
+      std::vector<Entry>::const_iterator end() const { return Entries.end(); }
+
+      /* The objects pointer may point to, or null if there are none */
+      const SparseBitVector<> * find(pointerInfo pointer) const {
+        auto it = std::lower_bound(Entries.begin(), Entries.end(), pointer, keyLess);
+        return it != Entries.end() && it->Key == pointer ? &it->Pointees : nullptr;
+      }
+
+      /* Add objects to the pointees of pointer. Return true if they changed. */
+      bool insert(pointerInfo pointer, const SparseBitVector<> & objects) {
+        if (objects.empty())
+          return false;
+        auto it = std::lower_bound(Entries.begin(), Entries.end(), pointer, keyLess);
+        if (it == Entries.end() || it->Key != pointer) {
+          // objects may belong to another entry, so copy it before the vector moves
+          Entry entry = { pointer, objects, 0, 0 };
+          it = Entries.insert(it, std::move(entry));
+        } else if (!(it->Pointees |= objects)) {
+          return false;
+        }
+        rehash(*it);
+        return true;
+      }
+
+      /* Bytes of the entries and of the elements of their pointee sets, on the heap */
+      size_t payloadBytes() const {
+        typedef SparseBitVectorElement<> Element;
+        size_t bytes = Entries.capacity() * sizeof(Entry);
+        for (const Entry & entry : Entries) {
+          // One list node per run of Element::BITS_PER_ELEMENT indices with an object
+          unsigned last = ~0u;
+          for (unsigned o : entry.Pointees)
+            if (o / Element::BITS_PER_ELEMENT != last) {
+              last = o / Element::BITS_PER_ELEMENT;
+              bytes += sizeof(Element) + 2 * sizeof(void *);
+            }
+        }
+        return bytes;
+      }
+
+      bool insert(pointerInfo pointer, unsigned object) {
+        SparseBitVector<> objects;
+        objects.set(object);
+        return insert(pointer, objects);
+      }
+
+      /* Rename each instruction index i to newIndex[i], dropping those mapped to ~0u */
+      void remap(const std::vector<unsigned> & newIndex) {
+        std::vector<Entry> entries;
+        entries.swap(Entries);
+        Hash = 0;
+        NumPairs = 0;
+        for (auto & entry : entries) {
+          unsigned key = newIndex[entry.Key.second];
+          if (key == ~0u)
+            continue;
+          SparseBitVector<> objects;
+          for (unsigned o : entry.Pointees)
+            if (newIndex[o] != ~0u)
+              objects.set(newIndex[o]);
+          insert(make_pair(entry.Key.first, key), objects);
+        }
+      }
 
        /* Print out the information */
-      void print() {
-        for(auto pointer : pointerMap) {
-          errs() << pointer.first.first << pointer.first.second << "->(";
-          for(auto pointee : pointer.second) {
-            errs() << pointee.first << pointee.second << "/";
+      void print(raw_ostream & OS) {
+        for(auto & pointer : Entries) {
+          OS << pointer.Key.first << pointer.Key.second << "->(";
+          for(unsigned pointee : pointer.Pointees) {
+            OS << 'M' << pointee << "/";
           }
-          errs() << ")|";
+          OS << ")|";
         }
-        errs() << "\n";
+        OS << "\n";
+      }
+
+      /* Hash of the information, for interning */
+      size_t hash() const {
+        return Hash;
       }
 
       /* Compare two pieces of information */
       static bool equals(MayPointToInfo *info1, MayPointToInfo *info2) {
-        auto map1 = info1->pointerMap;
-        auto map2 = info2->pointerMap;
-        return map1.size() == map2.size() && std::equal(map1.begin(), map1.end(), map2.begin());
+        if (info1 == info2)
+          return true;
+        if (info1->Hash != info2->Hash || info1->NumPairs != info2->NumPairs ||
+            info1->Entries.size() != info2->Entries.size())
+          return false;
+        for (unsigned i = 0; i < info1->Entries.size(); ++i)
+          if (info1->Entries[i].Key != info2->Entries[i].Key ||
+              info1->Entries[i].Pointees != info2->Entries[i].Pointees)
+            return false;
+        return true;
       }
 
       /* Join two pieces of information.
          The third parameter points to the result. */
       static MayPointToInfo* join(MayPointToInfo *info1, MayPointToInfo *info2, MayPointToInfo *result) {
-        result->pointerMap.insert(info1->pointerMap.begin(), info1->pointerMap.end());
-        result->pointerMap.insert(info2->pointerMap.begin(), info2->pointerMap.end());
+        joinInto(result, info1);
+        joinInto(result, info2);
         return result;
-      }   
+      }
+
+      /* Join src into dst, merging the pointee sets of common pointers.
+         Return true if dst changed. */
+      static bool joinInto(MayPointToInfo *dst, MayPointToInfo *src) {
+        if (dst == src || src->Entries.empty())
+          return false;
+        bool changed = false;
+        // Pointers of src that dst does not have, in key order
+        std::vector<Entry> added;
+        auto d = dst->Entries.begin();
+        for (auto & entry : src->Entries) {
+          while (d != dst->Entries.end() && d->Key < entry.Key)
+            ++d;
+          if (d == dst->Entries.end() || d->Key != entry.Key) {
+            added.push_back(entry);
+          } else if (d->Pointees |= entry.Pointees) {
+            dst->rehash(*d);
+            changed = true;
+          }
+        }
+        if (added.empty())
+          return changed;
+
+        for (auto & entry : added) {
+          dst->Hash += entry.Hash;
+          dst->NumPairs += entry.Count;
+        }
+        std::vector<Entry> merged;
+        merged.reserve(dst->Entries.size() + added.size());
+        std::merge(std::make_move_iterator(dst->Entries.begin()), std::make_move_iterator(dst->Entries.end()),
+                   std::make_move_iterator(added.begin()), std::make_move_iterator(added.end()),
+                   std::back_inserter(merged),
+                   [](const Entry & a, const Entry & b) { return a.Key < b.Key; });
+        dst->Entries.swap(merged);
+        return true;
+      }
 
     };
 
 
-  class MayPointToAnalysis : public DataFlowAnalysis<MayPointToInfo, true> {
+  /*
+   * Steensgaard's unification-based points-to graph. Every node (a pointer Ri or a
+   * memory object Mi) belongs to a class, and a class points to at most one class.
+   * An assignment unifies the classes its two sides point to, so a function is
+   * processed in one pass, in near-linear time.
+   */
+  class PointsToUnifier {
+    private:
+      std::vector<unsigned> Parent;
+      std::vector<unsigned> Rank;
+      // The class that the class of a representative points to, or None
+      std::vector<unsigned> Pointee;
 
     public:
+      enum : unsigned { None = ~0u };
 
-      MayPointToAnalysis(MayPointToInfo & bottom, MayPointToInfo & initState) : 
-                    DataFlowAnalysis<MayPointToInfo, true>(bottom, initState) {}
+      PointsToUnifier(unsigned numNodes) : Rank(numNodes, 0), Pointee(numNodes, None) {
+        for (unsigned n = 0; n < numNodes; ++n)
+          Parent.push_back(n);
+      }
 
-      void flowfunction(Instruction * I,
-                        std::vector<unsigned> & IncomingEdges,
-                        std::vector<unsigned> & OutgoingEdges,
-                        std::vector<MayPointToInfo *> & Infos) {
+      unsigned find(unsigned n) {
+        while (Parent[n] != n) {
+          Parent[n] = Parent[Parent[n]];
+          n = Parent[n];
+        }
+        return n;
+      }
 
-        unsigned instrIdx = InstrToIndex[I];
+      /* The class pointed to by the class of n, or None */
+      unsigned pointee(unsigned n) {
+        unsigned p = Pointee[find(n)];
+        return p == None ? None : find(p);
+      }
 
-        // join the incoming data flows
-        MayPointToInfo *tempInfo = new MayPointToInfo();       
+      /* The class pointed to by the class of n, created empty if there is none yet */
+      unsigned deref(unsigned n) {
+        n = find(n);
+        if (Pointee[n] == None) {
+          Pointee[n] = Parent.size();
+          Parent.push_back(Parent.size());
+          Rank.push_back(0);
+          Pointee.push_back(None);
+        }
+        return find(Pointee[n]);
+      }
 
-        for(auto incoming : IncomingEdges) {
-          Edge e = std::make_pair(incoming, instrIdx);
-          MayPointToInfo::join(EdgeToInfo[e], tempInfo, tempInfo);
+      /* Merge the classes of a and b, and then the classes they point to */
+      void unify(unsigned a, unsigned b) {
+        std::vector<std::pair<unsigned, unsigned>> pending(1, std::make_pair(a, b));
+        while (!pending.empty()) {
+          a = find(pending.back().first);
+          b = find(pending.back().second);
+          pending.pop_back();
+          if (a == b)
+            continue;
+
+          if (Rank[a] < Rank[b])
+            std::swap(a, b);
+          Parent[b] = a;
+          if (Rank[a] == Rank[b])
+            ++Rank[a];
+
+          if (Pointee[a] == None)
+            Pointee[a] = Pointee[b];
+          else if (Pointee[b] != None)
+            pending.push_back(std::make_pair(Pointee[a], Pointee[b]));
+        }
+      }
+  };
+
+
+  /*
+   * A flow-insensitive points-to constraint between two nodes. Ri is node i and
+   * Mi is node numNodes + i.
+   *   AddressOf: Dst -> Src         (Src is a memory object)
+   *   Copy:      Dst -> X for every Src -> X
+   *   Load:      Dst -> Y for every Src -> X -> Y
+   *   Store:     Y -> X for every Dst -> Y and Src -> X
+   */
+  struct PointsToConstraint {
+    enum Kind { AddressOf, Copy, Load, Store };
+    Kind K;
+    unsigned Dst;
+    unsigned Src;
+  };
+
+  /*
+   * Andersen's inclusion-based points-to solver. A copy edge src -> dst of the
+   * constraint graph means pts(dst) includes pts(src); load and store constraints add
+   * copy edges as the points-to sets of their pointers grow. A node taken off the
+   * worklist only propagates the objects it has not propagated before (difference
+   * propagation). When an edge brings nothing new because both ends have the same set,
+   * the edge may lie on a cycle, whose nodes must all end up with the same set; the
+   * cycles reachable from it are then collapsed into single nodes (lazy cycle
+   * detection). Points-to sets are sparse bit vectors of object indices.
+   */
+  class AndersenSolver {
+    private:
+      struct Node {
+        SparseBitVector<> Pts;
+        // The part of Pts that has been propagated
+        SparseBitVector<> Done;
+        DenseSet<unsigned> Succs;
+        // Load destinations and store sources that use this node as the pointer
+        std::vector<unsigned> Loads;
+        std::vector<unsigned> Stores;
+      };
+
+      std::vector<Node> Nodes;
+      // Union-find of the collapsed cycles; the representative holds the node data
+      std::vector<unsigned> Parent;
+      // The node of object o is ObjectBase + o
+      unsigned ObjectBase;
+      std::vector<unsigned> Worklist;
+      std::vector<bool> InQueue;
+      // Edges that already triggered a cycle search
+      DenseSet<std::pair<unsigned, unsigned>> Checked;
+
+      void push(unsigned n) {
+        n = find(n);
+        if (!InQueue[n]) {
+          InQueue[n] = true;
+          Worklist.push_back(n);
         }
+      }
 
-        string opName = I->getOpcodeName();
+      /* Add the copy edge src -> dst while solving */
+      void addEdge(unsigned src, unsigned dst) {
+        src = find(src);
+        dst = find(dst);
+        if (src == dst || !Nodes[src].Succs.insert(dst).second)
+          return;
+        if (Nodes[dst].Pts |= Nodes[src].Pts)
+          push(dst);
+      }
 
+      /* Merge the node b into the node a */
+      void merge(unsigned a, unsigned b) {
+        Node & A = Nodes[a];
+        Node & B = Nodes[b];
+        Parent[b] = a;
+        A.Pts |= B.Pts;
+        // Objects that one side has not propagated yet are propagated again for both
+        A.Done &= B.Done;
+        for (unsigned succ : B.Succs)
+          A.Succs.insert(succ);
+        A.Loads.insert(A.Loads.end(), B.Loads.begin(), B.Loads.end());
+        A.Stores.insert(A.Stores.end(), B.Stores.begin(), B.Stores.end());
+        B = Node();
+        push(a);
+      }
 
-        // alloca: in U {Ri->Mi}
-        if (opName == "alloca") {
-          tempInfo->pointerMap[make_pair('R', instrIdx)].insert(make_pair('M', instrIdx));
-        }    
+      /* Collapse the cycles reachable from root (Tarjan's algorithm) */
+      void collapseCycles(unsigned root) {
+        DenseMap<unsigned, unsigned> index;
+        DenseMap<unsigned, unsigned> low;
+        std::vector<unsigned> stack;
+        DenseSet<unsigned> onStack;
+        // DFS frames: a node and its successors that remain to be visited
+        std::vector<std::pair<unsigned, std::vector<unsigned>>> frames;
+
+        auto enter = [&](unsigned n) {
+          unsigned id = index.size();
+          index[n] = id;
+          low[n] = id;
+          stack.push_back(n);
+          onStack.insert(n);
+          std::vector<unsigned> succs;
+          for (unsigned succ : Nodes[n].Succs)
+            if (find(succ) != n)
+              succs.push_back(find(succ));
+          frames.push_back(std::make_pair(n, succs));
+        };
+
+        enter(find(root));
+        while (!frames.empty()) {
+          unsigned n = frames.back().first;
+          if (!frames.back().second.empty()) {
+            unsigned succ = frames.back().second.back();
+            frames.back().second.pop_back();
+            if (!index.count(succ))
+              enter(succ);
+            else if (onStack.count(succ))
+              low[n] = std::min(low[n], index[succ]);
+            continue;
+          }
 
-        // bitcast / getelementptr: in U {Ri->X | Rv->X\in in}
-        else if (opName == "bitcast" || opName == "getelementptr"){
-          Instruction * operand = (Instruction *)I->getOperand(0);
-          unsigned operandIdx = InstrToIndex[operand];
-          pointerInfo Rv = make_pair('R', operandIdx);
-          
-          if(tempInfo->pointerMap.find(Rv) != tempInfo->pointerMap.end()) {
-            for(auto x : tempInfo->pointerMap[Rv]) {
-              tempInfo->pointerMap[make_pair('R',instrIdx)].insert(x);
-            }
+          frames.pop_back();
+          if (!frames.empty()) {
+            unsigned parent = frames.back().first;
+            low[parent] = std::min(low[parent], low[n]);
           }
+          if (low[n] != index[n])
+            continue;
+
+          // n is the root of a strongly connected component
+          unsigned member;
+          do {
+            member = stack.back();
+            stack.pop_back();
+            onStack.erase(member);
+            if (member != n)
+              merge(n, member);
+          } while (member != n);
         }
+      }
 
-        // load: in U {Ri->Y | Rp->X\in in & X->Y\in in}
-        else if (opName == "load"){
-
-          Instruction * operand = (Instruction *)I->getOperand(0);
-          unsigned operandIdx = InstrToIndex[operand];
-          pointerInfo Rp = make_pair('R', operandIdx);
+      /* Propagate the new objects of node n */
+      void visit(unsigned n) {
+        SparseBitVector<> delta = Nodes[n].Pts;
+        delta.intersectWithComplement(Nodes[n].Done);
+        if (delta.empty())
+          return;
+        Nodes[n].Done |= delta;
+
+        for (unsigned o : delta) {
+          for (unsigned dst : Nodes[n].Loads)
+            addEdge(ObjectBase + o, dst);
+          for (unsigned src : Nodes[n].Stores)
+            addEdge(src, ObjectBase + o);
+        }
 
-          if(tempInfo->pointerMap.find(Rp) != tempInfo->pointerMap.end()) {
-            for(auto x : tempInfo->pointerMap[Rp]) {
-              if(tempInfo->pointerMap.find(x) != tempInfo->pointerMap.end()) {
-                for(auto y : tempInfo->pointerMap[x]) {
-                  tempInfo->pointerMap[make_pair('R',instrIdx)].insert(y);
-                }
-              }
+        std::vector<unsigned> succs(Nodes[n].Succs.begin(), Nodes[n].Succs.end());
+        for (unsigned succ : succs) {
+          succ = find(succ);
+          if (succ == n)
+            continue;
+          if (Nodes[succ].Pts |= delta) {
+            push(succ);
+            continue;
+          }
+          if (Nodes[succ].Pts == Nodes[n].Pts && Checked.insert(std::make_pair(n, succ)).second) {
+            collapseCycles(succ);
+            if (find(n) != n) {
+              // n was merged away before delta reached all its successors
+              Nodes[find(n)].Done.intersectWithComplement(delta);
+              push(n);
+              return;
             }
           }
         }
+      }
 
-        // store: in U {Y->X | Rv->X\in in & Rp->Y\in in}
-        else if (opName == "store"){
+    public:
+      AndersenSolver(unsigned numNodes, unsigned objectBase) :
+                     Nodes(numNodes), ObjectBase(objectBase), InQueue(numNodes, false) {
+        for (unsigned n = 0; n < numNodes; ++n)
+          Parent.push_back(n);
+      }
 
-          Instruction * operand0 = (Instruction *)I->getOperand(0);
-          unsigned operandIdx0 = InstrToIndex[operand0];
-          pointerInfo Rv = make_pair('R', operandIdx0);
+      unsigned find(unsigned n) {
+        while (Parent[n] != n) {
+          Parent[n] = Parent[Parent[n]];
+          n = Parent[n];
+        }
+        return n;
+      }
 
-          Instruction * operand1 = (Instruction *)I->getOperand(1);
-          unsigned operandIdx1 = InstrToIndex[operand1];
-          pointerInfo Rp = make_pair('R', operandIdx1);
+      void addConstraint(const PointsToConstraint & c) {
+        switch (c.K) {
+          case PointsToConstraint::AddressOf:
+            Nodes[c.Dst].Pts.set(c.Src - ObjectBase);
+            break;
+          case PointsToConstraint::Copy:
+            Nodes[c.Src].Succs.insert(c.Dst);
+            break;
+          case PointsToConstraint::Load:
+            Nodes[c.Src].Loads.push_back(c.Dst);
+            break;
+          case PointsToConstraint::Store:
+            Nodes[c.Dst].Stores.push_back(c.Src);
+            break;
+        }
+      }
 
-          if(tempInfo->pointerMap.find(Rv) != tempInfo->pointerMap.end()) {
-            for(auto x : tempInfo->pointerMap[Rv]) {
-              if(tempInfo->pointerMap.find(Rp) != tempInfo->pointerMap.end()) {
-                for(auto y : tempInfo->pointerMap[Rp]) {
-                  tempInfo->pointerMap[y].insert(x);
-                }
-              }
-            }
-          }
+      /* Compute the points-to sets. Return the number of nodes visited. */
+      unsigned solve() {
+        unsigned visits = 0;
+        for (unsigned n = 0; n < Nodes.size(); ++n)
+          if (!Nodes[n].Pts.empty())
+            push(n);
+
+        while (!Worklist.empty()) {
+          unsigned n = Worklist.back();
+          Worklist.pop_back();
+          InQueue[n] = false;
+          if (find(n) != n)
+            continue;
+          ++visits;
+          visit(n);
         }
+        return visits;
+      }
+
+      /* The indices of the objects node n may point to */
+      const SparseBitVector<> & pointsTo(unsigned n) {
+        return Nodes[find(n)].Pts;
+      }
+  };
 
-        // select: in U {Ri->X | R1->X\in in} U {Ri->X | R2->X\in in}
-        else if (opName == "select"){
 
-          Instruction * operand1 = (Instruction *)I->getOperand(1);
-          unsigned operandIdx1 = InstrToIndex[operand1];
-          pointerInfo R1 = make_pair('R', operandIdx1);
+  class MayPointToAnalysis : public DataFlowAnalysis<MayPointToInfo, true, MayPointToAnalysis> {
+
+    private:
+
+      /* info U {Ri->X | Rv->X \in info} */
+      static void addPointees(MayPointToInfo *info, pointerInfo Ri, pointerInfo Rv) {
+        if (const SparseBitVector<> * xs = info->find(Rv))
+          info->insert(Ri, *xs);
+      }
+
+      // alloca: in U {Ri->Mi}
+      void flowAlloca(unsigned instrIdx, MayPointToInfo *info) {
+        info->insert(make_pair('R', instrIdx), instrIdx);
+      }
+
+      // bitcast / getelementptr: in U {Ri->X | Rv->X\in in}
+      void flowCast(Instruction * I, unsigned instrIdx, MayPointToInfo *info) {
+        Instruction * operand = (Instruction *)I->getOperand(0);
+        addPointees(info, make_pair('R', instrIdx), make_pair('R', getIndex(operand)));
+      }
+
+      // load: in U {Ri->Y | Rp->X\in in & X->Y\in in}
+      void flowLoad(Instruction * I, unsigned instrIdx, MayPointToInfo *info) {
+        Instruction * operand = (Instruction *)I->getOperand(0);
+        pointerInfo Rp = make_pair('R', getIndex(operand));
+
+        const SparseBitVector<> * xs = info->find(Rp);
+        if (!xs)
+          return;
+        SparseBitVector<> ys;
+        for (unsigned x : *xs)
+          if (const SparseBitVector<> * pointees = info->find(make_pair('M', x)))
+            ys |= *pointees;
+        info->insert(make_pair('R', instrIdx), ys);
+      }
+
+      // store: in U {Y->X | Rv->X\in in & Rp->Y\in in}
+      void flowStore(Instruction * I, MayPointToInfo *info) {
+        Instruction * operand0 = (Instruction *)I->getOperand(0);
+        pointerInfo Rv = make_pair('R', getIndex(operand0));
+
+        Instruction * operand1 = (Instruction *)I->getOperand(1);
+        pointerInfo Rp = make_pair('R', getIndex(operand1));
+
+        const SparseBitVector<> * xs = info->find(Rv);
+        const SparseBitVector<> * ys = info->find(Rp);
+        if (!xs || !ys)
+          return;
+        // insert may move the entries that xs and ys point into
+        SparseBitVector<> objects = *xs;
+        SparseBitVector<> targets = *ys;
+        for (unsigned y : targets)
+          info->insert(make_pair('M', y), objects);
+      }
+
+      // select: in U {Ri->X | R1->X\in in} U {Ri->X | R2->X\in in}
+      void flowSelect(Instruction * I, unsigned instrIdx, MayPointToInfo *info) {
+        Instruction * operand1 = (Instruction *)I->getOperand(1);
+        Instruction * operand2 = (Instruction *)I->getOperand(2);
+
+        addPointees(info, make_pair('R', instrIdx), make_pair('R', getIndex(operand1)));
+        addPointees(info, make_pair('R', instrIdx), make_pair('R', getIndex(operand2)));
+      }
+
+      // phi: in U {Ri->X | R0->X\in in} U ... U {Ri->X | Rk->X\in in}, for each phi Ri of the block
+      void flowPhi(Instruction * I, unsigned instrIdx, MayPointToInfo *info) {
+        Instruction * firstNonPhi = I->getParent()->getFirstNonPHI();
+        unsigned firstNonPhiIdx = getIndex(firstNonPhi);
 
-          Instruction * operand2 = (Instruction *)I->getOperand(2);
-          unsigned operandIdx2 = InstrToIndex[operand2];
-          pointerInfo R2 = make_pair('R', operandIdx2);
+        for (unsigned i = instrIdx; i < firstNonPhiIdx; ++i) {
+          PHINode * phiInstr = (PHINode *) IndexToInstr[i];
 
-          if(tempInfo->pointerMap.find(R1) != tempInfo->pointerMap.end()) {
-            for(auto x : tempInfo->pointerMap[R1]) {
-              tempInfo->pointerMap[make_pair('R',instrIdx)].insert(x);
+          for (Value * incoming : phiInstr->incoming_values())
+            addPointees(info, make_pair('R', i), make_pair('R', getIndex(incoming)));
+        }
+      }
+
+      /*
+       * Flow-insensitive modes: the rules of the flow functions, applied to all the
+       * instructions of the function at once. Operands that are not instructions of
+       * the function have index 0 and never point to anything in the flow-sensitive
+       * analysis, so the rules that read them are dropped.
+       */
+      std::vector<PointsToConstraint> collectConstraints() {
+        unsigned numNodes = IndexToInstr.size();
+        std::vector<PointsToConstraint> constraints;
+        auto add = [&](PointsToConstraint::Kind k, unsigned dst, unsigned src) {
+          PointsToConstraint c = { k, dst, src };
+          constraints.push_back(c);
+        };
+
+        for (unsigned i = 1; i < numNodes; ++i) {
+          Instruction * I = IndexToInstr[i];
+          switch (I->getOpcode()) {
+            case Instruction::Alloca:
+              add(PointsToConstraint::AddressOf, i, numNodes + i);
+              break;
+            case Instruction::BitCast:
+            case Instruction::GetElementPtr:
+              if (unsigned v = getIndex(I->getOperand(0)))
+                add(PointsToConstraint::Copy, i, v);
+              break;
+            case Instruction::Load:
+              if (unsigned p = getIndex(I->getOperand(0)))
+                add(PointsToConstraint::Load, i, p);
+              break;
+            case Instruction::Store: {
+              unsigned v = getIndex(I->getOperand(0));
+              unsigned p = getIndex(I->getOperand(1));
+              if (v && p)
+                add(PointsToConstraint::Store, p, v);
+              break;
             }
+            case Instruction::Select:
+              for (unsigned j = 1; j <= 2; ++j)
+                if (unsigned v = getIndex(I->getOperand(j)))
+                  add(PointsToConstraint::Copy, i, v);
+              break;
+            case Instruction::PHI:
+              for (Value * incoming : cast<PHINode>(I)->incoming_values())
+                if (unsigned v = getIndex(incoming))
+                  add(PointsToConstraint::Copy, i, v);
+              break;
+            default:
+              break;
           }
+        }
+        return constraints;
+      }
 
-          if(tempInfo->pointerMap.find(R2) != tempInfo->pointerMap.end()) {
-            for(auto x : tempInfo->pointerMap[R2]) {
-              tempInfo->pointerMap[make_pair('R',instrIdx)].insert(x);
-            }
+      /* Put info on every edge. Edges share it, so boundary mode has nothing to save. */
+      void setAllEdges(MayPointToInfo * info) {
+        setBoundaryOnly(false);
+        for (unsigned e = 0; e < EdgeInfos.size(); ++e)
+          EdgeInfos[e] = info;
+      }
+
+    public:
+
+      MayPointToAnalysis(MayPointToInfo & bottom, MayPointToInfo & initState) : 
+                    DataFlowAnalysis(bottom, initState, ReversePostOrder) {}
+
+      /*
+       * Steensgaard mode: solve the constraints by unification. Each node points to a
+       * single class, so the result over-approximates the flow-sensitive information
+       * of every edge and replaces the worklist algorithm.
+       */
+      void runSteensgaard(Function * func) {
+        Stats = SolverStats();
+        ScopedNanos solveTimer(&Stats.SolveNanos);
+        initializeEdges(func);
+
+        unsigned numNodes = IndexToInstr.size();
+        PointsToUnifier graph(2 * numNodes);
+        for (auto & c : collectConstraints()) {
+          switch (c.K) {
+            case PointsToConstraint::AddressOf:
+              graph.unify(graph.deref(c.Dst), c.Src);
+              break;
+            case PointsToConstraint::Copy:
+              graph.unify(graph.deref(c.Dst), graph.deref(c.Src));
+              break;
+            case PointsToConstraint::Load:
+              graph.unify(graph.deref(c.Dst), graph.deref(graph.deref(c.Src)));
+              break;
+            case PointsToConstraint::Store:
+              graph.unify(graph.deref(graph.deref(c.Dst)), graph.deref(c.Src));
+              break;
           }
         }
 
-        // phi: in U {Ri->X | R0->X\in in} U ... U {Ri->X | Rk->X\in in}
-        else if (opName == "phi") {
+        // The memory objects of each class
+        std::map<unsigned, SparseBitVector<>> objects;
+        for (unsigned i = 1; i < numNodes; ++i)
+          if (isa<AllocaInst>(IndexToInstr[i]))
+            objects[graph.find(numNodes + i)].set(i);
+
+        MayPointToInfo * result = newInfo();
+        for (unsigned n = 1; n < 2 * numNodes; ++n) {
+          if (n == numNodes)
+            continue;
+          unsigned p = graph.pointee(n);
+          auto it = p == PointsToUnifier::None ? objects.end() : objects.find(p);
+          if (it == objects.end())
+            continue;
+          pointerInfo key = n < numNodes ? make_pair('R', n) : make_pair('M', n - numNodes);
+          result->insert(key, it->second);
+        }
+        setAllEdges(result);
+      }
 
-          Instruction * firstNonPhi = I->getParent()->getFirstNonPHI();
-          unsigned firstNonPhiIdx = InstrToIndex[firstNonPhi];
+      /*
+       * Andersen mode: solve the constraints by inclusion. More precise than
+       * Steensgaard mode, and still an over-approximation of the flow-sensitive
+       * information of every edge.
+       */
+      void runAndersen(Function * func) {
+        Stats = SolverStats();
+        ScopedNanos solveTimer(&Stats.SolveNanos);
+        initializeEdges(func);
+
+        unsigned numNodes = IndexToInstr.size();
+        AndersenSolver solver(2 * numNodes, numNodes);
+        for (auto & c : collectConstraints())
+          solver.addConstraint(c);
+        Stats.NumPops = solver.solve();
+
+        MayPointToInfo * result = newInfo();
+        for (unsigned n = 1; n < 2 * numNodes; ++n) {
+          if (n == numNodes)
+            continue;
+          pointerInfo key = n < numNodes ? make_pair('R', n) : make_pair('M', n - numNodes);
+          result->insert(key, solver.pointsTo(n));
+        }
+        setAllEdges(result);
+      }
 
-          for (unsigned i = instrIdx; i < firstNonPhiIdx; ++i) {
-            Instruction * instr = IndexToInstr[i];
-            PHINode * phiInstr = (PHINode *) instr;
+      void flowfunction(Instruction * I,
+                        std::vector<unsigned> & IncomingEdges,
+                        std::vector<unsigned> & OutgoingEdges,
+                        std::vector<MayPointToInfo *> & Infos) {
 
-            for (unsigned j = 0; j < phiInstr->getNumIncomingValues(); ++j) {
-              Instruction * operand = (Instruction *)I->getOperand(j);
-              unsigned operandIdx = InstrToIndex[operand];
-              pointerInfo Rj = make_pair('R',operandIdx);
+        unsigned instrIdx = getIndex(I);
 
-              if (tempInfo->pointerMap.find(Rj) != tempInfo->pointerMap.end()) {
-                for (auto x : tempInfo->pointerMap[Rj]) {
-                  tempInfo->pointerMap[make_pair('R',instrIdx)].insert(x);
-                }
-              }
-            }
-          }
+        // join the incoming data flows
+        MayPointToInfo *tempInfo = newInfo();
+
+        for(auto incoming : IncomingEdges) {
+          joinInfo(tempInfo, getEdgeInfo(incoming, instrIdx));
+        }
+
+        switch (I->getOpcode()) {
+          case Instruction::Alloca:
+            flowAlloca(instrIdx, tempInfo);
+            break;
+          case Instruction::BitCast:
+          case Instruction::GetElementPtr:
+            flowCast(I, instrIdx, tempInfo);
+            break;
+          case Instruction::Load:
+            flowLoad(I, instrIdx, tempInfo);
+            break;
+          case Instruction::Store:
+            flowStore(I, tempInfo);
+            break;
+          case Instruction::Select:
+            flowSelect(I, instrIdx, tempInfo);
+            break;
+          case Instruction::PHI:
+            flowPhi(I, instrIdx, tempInfo);
+            break;
+          default:
+            break;
         }
 
         for(unsigned i = 0; i < OutgoingEdges.size(); i++) {
@@ -194,20 +809,62 @@ namespace {
 
 };
 
-   struct MayPointToAnalysisPass : public FunctionPass {
-      static char ID;
+   struct MayPointToAnalysisPass : public ModulePass {
+     static char ID;
+     static constexpr const char * DebugType = DEBUG_TYPE;
+     // Solver counters of the functions, for -stats and the JSON report
+     SolverStatsRecorder<MayPointToAnalysisPass> Stats;
+
+     MayPointToAnalysisPass() : ModulePass(ID) {}
+
+     void analyzeFunction(Function &F, raw_ostream &OS) {
+       MayPointToInfo bottom;
+
+       MayPointToAnalysis mpt(bottom, bottom);
+       mpt.setInterning(MaypointtoIntern);
+       mpt.setBoundaryOnly(F.getInstructionCount() > MaypointtoBoundaryLimit);
+       mpt.setTimeJoins(TimePassesIsEnabled || !MaypointtoStatsJSON.empty());
+
+       // The timers of a region cannot run on several threads at once
+       bool timePhases = TimePassesIsEnabled && MaypointtoThreads <= 1;
+       if (!MaypointtoQuery.empty()) {
+         // Demand-driven: only what the queried instructions depend on is solved
+         for (unsigned index : MaypointtoQuery) {
+           if (index == 0 || index > F.getInstructionCount())
+             continue;
+           OS << "Instr " << index << ":";
+           mpt.query(&F, index)->print(OS);
+         }
+       } else {
+         {
+           NamedRegionTimer T("solve", "Solve", DEBUG_TYPE, "May-point-to analysis", timePhases);
+           if (MaypointtoMode == SteensgaardMode ||
+               (MaypointtoMode == AutoMode && F.getInstructionCount() > MaypointtoAutoLimit))
+             mpt.runSteensgaard(&F);
+           else if (MaypointtoMode == AndersenMode)
+             mpt.runAndersen(&F);
+           else
+             mpt.runWorklistAlgorithm(&F);
+         }
+         {
+           NamedRegionTimer T("print", "Print", DEBUG_TYPE, "May-point-to analysis", timePhases);
+           mpt.print(OS);
+         }
+       }
+
+       Stats.record(F, mpt.getStats(), !MaypointtoStatsJSON.empty());
+     }
+
+     bool runOnModule(Module &M) override {
+       analyzeFunctionsInParallel(M, MaypointtoThreads, [this](Function &F, raw_ostream &OS) {
+         analyzeFunction(F, OS);
+       });
+       if (!MaypointtoStatsJSON.empty())
+         Stats.writeJSON(MaypointtoStatsJSON, M);
+       return false;
+     }
+   };
 
-      MayPointToAnalysisPass() : FunctionPass(ID) {}
-
-      bool runOnFunction(Function &F) override { 
-        MayPointToInfo bottom;
-
-        MayPointToAnalysis mpt(bottom, bottom);
-        mpt.runWorklistAlgorithm(&F);
-        mpt.print();
-        return false;
-      }
-   }; 
 }
 
 char MayPointToAnalysisPass::ID = 0;